@@ -0,0 +1,185 @@
+// Command throughput of a running server, measured as commands per second of server CPU time.
+//
+//   gcc -O2 -o command_bench bench/command_bench.c
+//   taskset -c 0 ./server 9999 --workers=1 &
+//   ./command_bench 9999 $! [commands]
+//
+// Two text clients, benchA and benchB, are registered (or logged in when they already exist). benchA sends
+// the commands in batches that mix DIRECT_MESSAGE to benchB, VIEW_PLAYER_BIO, CHALLENGE of an unknown player
+// and GAME_MESSAGE outside a game, while both clients drain their replies. A final UPDATE_BIO marks the end.
+// The server's CPU time is read from /proc/<pid>/stat before and after, so the client's own cost and the
+// loopback wait do not count.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MIX_COMMANDS 4             // Commands in one copy of the mix
+#define MIX_COPIES 250             // Copies of the mix in one batch
+#define INPUT_SIZE (1 << 16)
+
+const char mix[] = "DIRECT_MESSAGE benchB hello there, how are you doing today?\n"
+                   "VIEW_PLAYER_BIO benchB\n"
+                   "CHALLENGE nosuchplayer\n"
+                   "GAME_MESSAGE good game everyone\n";
+const char end_command[] = "UPDATE_BIO command bench done\n";
+const char end_marker[] = "Your bio has been updated";
+
+// Server CPU time in seconds, user plus system, from /proc/<pid>/stat
+double server_cpu(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Failed to open the server's stat file");
+        exit(1);
+    }
+    char stat[1024];
+    size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[len] = '\0';
+
+    // Fields after the command name, which may itself hold spaces; utime and stime are the 12th and 13th
+    char *p = strrchr(stat, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        fprintf(stderr, "Unexpected format in %s\n", path);
+        exit(1);
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Connects, registers or logs in, and waits for the reply line
+int connect_client(struct sockaddr_in *address, const char *pseudo) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr *) address, sizeof(*address)) != 0) {
+            perror("connect");
+            exit(1);
+        }
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        char command[64];
+        int len = snprintf(command, sizeof(command), "%s %s pw\n", attempt == 0 ? "REGISTER" : "LOGIN", pseudo);
+        send(sock, command, len, 0);
+
+        char reply[256];
+        int received = (int) recv(sock, reply, sizeof(reply) - 1, 0);
+        if (received <= 0) {
+            fprintf(stderr, "Server closed the connection during login\n");
+            exit(1);
+        }
+        reply[received] = '\0';
+        if (strstr(reply, "AUTH 20") != NULL || strstr(reply, "successful") != NULL) {
+            fcntl(sock, F_SETFL, O_NONBLOCK);
+            return sock;
+        }
+        close(sock);
+    }
+    fprintf(stderr, "Could not register or log in %s\n", pseudo);
+    exit(1);
+}
+
+// Reads whatever is waiting, returns true once the end marker has been seen
+bool drain(int sock, bool watch_marker) {
+    static char input[INPUT_SIZE];
+    static int kept;               // Tail of the last read, the marker may straddle two reads
+    bool found = false;
+    int n;
+    while ((n = (int) recv(sock, input + kept, sizeof(input) - kept - 1, 0)) > 0) {
+        if (!watch_marker) {
+            continue;
+        }
+        int len = kept + n;
+        input[len] = '\0';
+        found = found || strstr(input, end_marker) != NULL;
+        kept = len < (int) sizeof(end_marker) - 1 ? len : (int) sizeof(end_marker) - 2;
+        memmove(input, input + len - kept, kept);
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        fprintf(stderr, "Server closed the connection\n");
+        exit(1);
+    }
+    return found;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: command_bench port server_pid [commands]\n");
+        return 0;
+    }
+    int pid = atoi(argv[2]);
+    long commands = argc > 3 ? atol(argv[3]) : 1000000;
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[1]))};
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    int a = connect_client(&address, "benchA");
+    int b = connect_client(&address, "benchB");
+
+    char *batch = malloc(MIX_COPIES * (sizeof(mix) - 1));
+    if (batch == NULL) {
+        perror("Failed to allocate the batch");
+        return 1;
+    }
+    for (int i = 0; i < MIX_COPIES; i++) {
+        memcpy(batch + i * (sizeof(mix) - 1), mix, sizeof(mix) - 1);
+    }
+    long batch_size = MIX_COPIES * (sizeof(mix) - 1);
+    long batches = commands / (MIX_COMMANDS * MIX_COPIES);
+    commands = batches * MIX_COMMANDS * MIX_COPIES;
+
+    double cpu_start = server_cpu(pid);
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    // Keeps benchA's socket full while both clients drain, then sends the marker and waits for it
+    long batch_index = 0, offset = 0;
+    bool end_sent = false, done = false;
+    while (!done) {
+        struct pollfd fds[2] = {{.fd = a, .events = POLLIN}, {.fd = b, .events = POLLIN}};
+        if (!end_sent) {
+            fds[0].events |= POLLOUT;
+        }
+        poll(fds, 2, 1000);
+        if (fds[1].revents) {
+            drain(b, false);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            done = drain(a, end_sent);
+        }
+        if (!end_sent && (fds[0].revents & POLLOUT)) {
+            if (batch_index == batches) {
+                send(a, end_command, sizeof(end_command) - 1, 0);
+                end_sent = true;
+                continue;
+            }
+            int sent = (int) send(a, batch + offset, batch_size - offset, 0);
+            if (sent < 0 && errno != EAGAIN) {
+                perror("send");
+                return 1;
+            }
+            offset += sent > 0 ? sent : 0;
+            if (offset == batch_size) {
+                offset = 0;
+                batch_index++;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double cpu = server_cpu(pid) - cpu_start;
+    double wall = wall_end.tv_sec - wall_start.tv_sec + (wall_end.tv_nsec - wall_start.tv_nsec) * 1e-9;
+    printf("%ld commands: server cpu %.2f s, %.0f commands/cpu-sec, %.0f commands/s wall\n", commands, cpu,
+           commands / cpu, commands / wall);
+    free(batch);
+    return 0;
+}
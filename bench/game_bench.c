@@ -0,0 +1,331 @@
+// Concurrent games against a running server, reporting moves per second and move latency.
+//
+//   gcc -O2 -o game_bench bench/game_bench.c
+//   ./server 9999 --workers=4 &
+//   ./game_bench 9999 <games> <seconds> [pressure]
+//
+// Every game is a pair of binary clients registered as g<N>. The first challenges the second, both always
+// play their first non-empty pit, and a finished pair challenges again. With `pressure`, one more client
+// keeps sending UPDATE_BIO, SHOW_GAMES and TOP so moves compete with profile writes and listings.
+// Accounts must not exist yet: run it against a fresh players file, or one that only holds other names.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PITS 6
+#define BOARD_FRAME 14             // Pits and store of the recipient, then of the opponent
+#define MSG_TEXT 1
+#define MSG_COMMAND 2
+#define MSG_MOVE 3
+#define MSG_BOARD 4
+#define MSG_ERROR 7
+#define INPUT_SIZE (1 << 16)
+#define MAX_SAMPLES 4000000
+#define WARMUP 1.0                 // Seconds of play before measuring starts
+
+typedef struct {
+    int socket;
+    int index;                     // Even clients challenge index + 1
+    bool authed;
+    bool first_pending;            // Told to go first before the board arrived
+    bool have_board;
+    bool rechallenge;
+    unsigned char board[BOARD_FRAME];
+    double sent;                   // When the pending move went out, 0 when none
+    unsigned char input[INPUT_SIZE];
+    int input_len;
+} BenchClient;
+
+BenchClient *clients;
+int client_count;
+double *samples;
+long sample_count;
+long moves;
+long games_finished;
+long forced_leaves;
+long pressure_rounds;
+
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void send_all(int socket, const void *data, int len) {
+    const char *p = data;
+    while (len > 0) {
+        int sent = (int) send(socket, p, len, 0);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                usleep(100);
+                continue;
+            }
+            perror("send");
+            exit(1);
+        }
+        p += sent;
+        len -= sent;
+    }
+}
+
+void send_frame(int socket, int type, const void *payload, int len) {
+    unsigned char frame[3 + 512];
+    frame[0] = (unsigned char) ((len + 1) >> 8);
+    frame[1] = (unsigned char) ((len + 1) & 0xff);
+    frame[2] = (unsigned char) type;
+    memcpy(frame + 3, payload, len);
+    send_all(socket, frame, len + 3);
+}
+
+void send_command(BenchClient *client, const char *command) {
+    send_frame(client->socket, MSG_COMMAND, command, (int) strlen(command));
+}
+
+void challenge(BenchClient *client) {
+    char command[64];
+    snprintf(command, sizeof(command), "CHALLENGE g%d", client->index + 1);
+    send_command(client, command);
+}
+
+// Plays the first non-empty pit, or leaves when there is none
+void play(BenchClient *client) {
+    for (int i = 0; i < PITS; i++) {
+        if (client->board[i] > 0) {
+            unsigned char pit = (unsigned char) (i + 1);
+            client->sent = bench_now();
+            send_frame(client->socket, MSG_MOVE, &pit, 1);
+            moves++;
+            return;
+        }
+    }
+    send_command(client, "LEAVE_GAME");
+    forced_leaves++;
+}
+
+void handle_text(BenchClient *client, const char *text) {
+    if (strstr(text, "is challenging you")) {
+        send_command(client, "ACCEPT");
+    }
+    if (strstr(text, "You go first")) {
+        if (client->have_board) {
+            play(client);
+        } else {
+            client->first_pending = true;
+        }
+    }
+    if (strstr(text, "Your turn!") || strstr(text, "Your turn against")) {
+        play(client);
+    }
+    if (strstr(text, "Your turn is over")) {
+        if (client->sent > 0 && sample_count < MAX_SAMPLES) {
+            samples[sample_count++] = bench_now() - client->sent;
+        }
+        client->sent = 0;
+    }
+    if (strstr(text, "Game finished")) {
+        client->have_board = false;
+        client->sent = 0;
+        if (client->index % 2 == 0) {
+            games_finished++;
+            client->rechallenge = true;
+        }
+    }
+    // The previous game is not gone yet, or the partner is busy answering someone else
+    if (strstr(text, "already have a game") || strstr(text, "already challenged") || strstr(text, "not online")) {
+        client->rechallenge = true;
+    }
+}
+
+void handle_input(BenchClient *client) {
+    int offset = 0;
+    if (!client->authed) {
+        unsigned char *newline = memchr(client->input, '\n', client->input_len);
+        if (newline == NULL) {
+            return;
+        }
+        offset = (int) (newline - client->input) + 1;
+        client->authed = true;
+        // Whichever of the pair logs in last starts their game
+        BenchClient *first = &clients[client->index & ~1];
+        if (first->authed && clients[first->index + 1].authed) {
+            challenge(first);
+        }
+    }
+
+    while (client->input_len - offset >= 3) {
+        int size = client->input[offset] << 8 | client->input[offset + 1];
+        if (client->input_len - offset < 2 + size) {
+            break;
+        }
+        int type = client->input[offset + 2];
+        unsigned char *payload = client->input + offset + 3;
+        int len = size - 1;
+        if (type == MSG_BOARD && len == BOARD_FRAME) {
+            memcpy(client->board, payload, BOARD_FRAME);
+            client->have_board = true;
+            if (client->first_pending) {
+                client->first_pending = false;
+                play(client);
+            }
+        } else if (type == MSG_TEXT || type == MSG_ERROR) {
+            char text[INPUT_SIZE];
+            memcpy(text, payload, len);
+            text[len] = '\0';
+            handle_text(client, text);
+        }
+        offset += 2 + size;
+    }
+    memmove(client->input, client->input + offset, client->input_len - offset);
+    client->input_len -= offset;
+}
+
+int connect_client(struct sockaddr_in *address, const char *login) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) address, sizeof(*address)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    send_all(sock, login, (int) strlen(login));
+    return sock;
+}
+
+// Keeps a few rounds of commands in flight, a new one for every listing that comes back
+void drive_pressure(int sock) {
+    static const char commands[] = "UPDATE_BIO pressure\nSHOW_GAMES\nTOP\n";
+    static const char marker[] = "Active games:";
+    static char input[INPUT_SIZE];
+    static int kept;               // Tail of the last read, a marker may straddle two reads
+    int n;
+    while ((n = (int) recv(sock, input + kept, sizeof(input) - kept - 1, 0)) > 0) {
+        int len = kept + n;
+        input[len] = '\0';
+        for (char *p = input; (p = strstr(p, marker)) != NULL; p += sizeof(marker) - 1) {
+            pressure_rounds++;
+            send_all(sock, commands, sizeof(commands) - 1);
+        }
+        kept = len < (int) sizeof(marker) - 1 ? len : (int) sizeof(marker) - 2;
+        memmove(input, input + len - kept, kept);
+    }
+}
+
+int compare_samples(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("Usage: game_bench port games seconds [pressure]\n");
+        return 0;
+    }
+    int games = atoi(argv[2]);
+    double seconds = atof(argv[3]);
+    bool pressure = argc > 4 && strcmp(argv[4], "pressure") == 0;
+
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[1]))};
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    client_count = 2 * games;
+    clients = calloc(client_count, sizeof(BenchClient));
+    samples = malloc(MAX_SAMPLES * sizeof(double));
+    int epoll_fd = epoll_create1(0);
+    if (clients == NULL || samples == NULL || epoll_fd < 0) {
+        perror("Benchmark setup failed");
+        return 1;
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        BenchClient *client = &clients[i];
+        char login[64];
+        snprintf(login, sizeof(login), "REGISTER g%d pw BINARY\n", i);
+        client->index = i;
+        client->socket = connect_client(&address, login);
+        fcntl(client->socket, F_SETFL, O_NONBLOCK);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->socket, &event);
+    }
+
+    int pressure_socket = -1;
+    if (pressure) {
+        pressure_socket = connect_client(&address, "REGISTER gpressure pw\n");
+        fcntl(pressure_socket, F_SETFL, O_NONBLOCK);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pressure_socket, &event);
+        for (int i = 0; i < 4; i++) {
+            send_all(pressure_socket, "SHOW_GAMES\n", 11);
+        }
+    }
+
+    double start = 0, end = 0;
+    long moves_at_start = 0, rounds_at_start = 0;
+    struct epoll_event events[256];
+    while (end == 0 || bench_now() < end) {
+        int n = epoll_wait(epoll_fd, events, 256, 1);
+        for (int k = 0; k < n; k++) {
+            BenchClient *client = events[k].data.ptr;
+            if (client == NULL) {
+                drive_pressure(pressure_socket);
+                continue;
+            }
+            int received = (int) recv(client->socket, client->input + client->input_len,
+                                      INPUT_SIZE - client->input_len, 0);
+            if (received <= 0) {
+                if (received < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                fprintf(stderr, "Client g%d disconnected\n", client->index);
+                return 1;
+            }
+            client->input_len += received;
+            handle_input(client);
+        }
+        for (int i = 0; i < client_count; i += 2) {
+            if (clients[i].rechallenge) {
+                clients[i].rechallenge = false;
+                challenge(&clients[i]);
+            }
+        }
+
+        // Measuring starts a warmup after every client has logged in
+        if (start == 0) {
+            bool all = true;
+            for (int i = 0; i < client_count && all; i++) {
+                all = clients[i].authed;
+            }
+            if (all) {
+                start = bench_now() + WARMUP;
+            }
+        } else if (end == 0 && bench_now() >= start) {
+            end = start + seconds;
+            moves_at_start = moves;
+            rounds_at_start = pressure_rounds;
+            sample_count = 0;
+            games_finished = 0;
+            forced_leaves = 0;
+        }
+    }
+
+    qsort(samples, sample_count, sizeof(double), compare_samples);
+    double p50 = sample_count ? samples[sample_count / 2] * 1e6 : 0;
+    double p99 = sample_count ? samples[sample_count * 99 / 100] * 1e6 : 0;
+    double max = sample_count ? samples[sample_count - 1] * 1e6 : 0;
+    printf("games %d: %.0f moves/s, latency p50 %.0f us p99 %.0f us max %.0f us, %ld games finished, "
+           "%ld forced leaves\n", games, (moves - moves_at_start) / seconds, p50, p99, max, games_finished,
+           forced_leaves);
+    if (pressure) {
+        printf("pressure: %.0f rounds/s\n", (pressure_rounds - rounds_at_start) / seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Server CPU time per listing command with a large registry and a few players online.
+//
+//   gcc -O2 -o listing_bench bench/listing_bench.c
+//   mkdir listing && cd listing && ../listing_bench --generate 100000
+//   ../server 9999 --workers=1 &
+//   ../listing_bench 9999 $! [rounds]
+//
+// --generate writes players.txt with the given number of accounts u0, u1, ..., each with two friends and a
+// one-line bio, and games.txt with 5000 finished games for servers that count wins from it. The run logs in
+// 20 of those accounts and sends each listing command `rounds` times (default 2000) from the first one, in
+// batches of 100 closed by VIEW_BIO so the server has answered all of them before its CPU time is read again.
+// The other clients drain what they receive, which includes the global messages.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ONLINE 20
+#define GAMES 5000
+#define BATCH 100                  // Listing commands sent before waiting for their replies
+#define INPUT_SIZE (1 << 16)
+
+const char *listings[] = {"SHOW_ONLINE", "TOP", "TOP_ONLINE", "GLOBAL_MESSAGE hi", "SHOW_PLAYERS"};
+const char end_marker[] = "Bio:\n";
+
+int generate(int count) {
+    FILE *players = fopen("players.txt", "w");
+    FILE *games = fopen("games.txt", "w");
+    if (players == NULL || games == NULL) {
+        perror("Failed to create the players or games file");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        fprintf(players, "u%d pw 0\nfriends: u%d u%d \nbio:\nhello, I am player %d\n-----\n", i, (i + 1) % count,
+                (i + 7) % count, i);
+    }
+    srand(1);
+    for (int i = 0; i < GAMES; i++) {
+        fprintf(games, "Winner: u%d\n", rand() % count);
+    }
+    fclose(players);
+    fclose(games);
+    return 0;
+}
+
+// Server CPU time in seconds, user plus system, from /proc/<pid>/stat
+double server_cpu(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Failed to open the server's stat file");
+        exit(1);
+    }
+    char stat[1024];
+    size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[len] = '\0';
+
+    // Fields after the command name, which may itself hold spaces; utime and stime are the 12th and 13th
+    char *p = strrchr(stat, ')');
+    unsigned long utime = 0, stime = 0;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        fprintf(stderr, "Unexpected format in %s\n", path);
+        exit(1);
+    }
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+int login(struct sockaddr_in *address, int account) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) address, sizeof(*address)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char command[64];
+    int len = snprintf(command, sizeof(command), "LOGIN u%d pw\n", account);
+    send(sock, command, len, 0);
+
+    char reply[256];
+    int received = (int) recv(sock, reply, sizeof(reply) - 1, 0);
+    reply[received > 0 ? received : 0] = '\0';
+    if (strstr(reply, "AUTH 200") == NULL && strstr(reply, "successful") == NULL) {
+        fprintf(stderr, "Login of u%d failed: %s\n", account, reply);
+        exit(1);
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    return sock;
+}
+
+// Reads whatever is waiting, returns true once the end marker has been seen
+bool drain(int sock, bool watch_marker) {
+    static char input[INPUT_SIZE];
+    static int kept;               // Tail of the last read, the marker may straddle two reads
+    bool found = false;
+    int n;
+    while ((n = (int) recv(sock, input + kept, sizeof(input) - kept - 1, 0)) > 0) {
+        if (!watch_marker) {
+            continue;
+        }
+        int len = kept + n;
+        input[len] = '\0';
+        found = found || strstr(input, end_marker) != NULL;
+        kept = len < (int) sizeof(end_marker) - 1 ? len : (int) sizeof(end_marker) - 2;
+        memmove(input, input + len - kept, kept);
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        fprintf(stderr, "Server closed the connection\n");
+        exit(1);
+    }
+    return found;
+}
+
+// Drains every client until the first one has seen the end marker
+void await_marker(int *socks) {
+    while (true) {
+        struct pollfd fds[ONLINE];
+        for (int i = 0; i < ONLINE; i++) {
+            fds[i] = (struct pollfd) {.fd = socks[i], .events = POLLIN};
+        }
+        poll(fds, ONLINE, 1000);
+        for (int i = 1; i < ONLINE; i++) {
+            if (fds[i].revents) {
+                drain(socks[i], false);
+            }
+        }
+        if (fds[0].revents && drain(socks[0], true)) {
+            return;
+        }
+    }
+}
+
+// Sends the command `rounds` times in batches, each closed by VIEW_BIO. Waiting for the bio between batches
+// keeps the replies in flight under the server's output queue limit.
+void run_listing(int *socks, const char *listing, int rounds) {
+    char batch[BATCH * 64 + 16];
+    for (int done = 0; done < rounds; done += BATCH) {
+        int len = 0;
+        for (int i = 0; i < BATCH && done + i < rounds; i++) {
+            len += snprintf(batch + len, sizeof(batch) - len, "%s\n", listing);
+        }
+        len += snprintf(batch + len, sizeof(batch) - len, "VIEW_BIO\n");
+        for (int offset = 0; offset < len;) {
+            int sent = (int) send(socks[0], batch + offset, len - offset, 0);
+            if (sent < 0 && errno != EAGAIN) {
+                perror("send");
+                exit(1);
+            }
+            offset += sent > 0 ? sent : 0;
+        }
+        await_marker(socks);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--generate") == 0) {
+        return generate(atoi(argv[2]));
+    }
+    if (argc < 3) {
+        printf("Usage: listing_bench --generate accounts | listing_bench port server_pid [rounds]\n");
+        return 0;
+    }
+    int pid = atoi(argv[2]);
+    int rounds = argc > 3 ? atoi(argv[3]) : 2000;
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[1]))};
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    // Accounts spread over the registry, which needs at least 20 * 997 of them
+    int socks[ONLINE];
+    for (int i = 0; i < ONLINE; i++) {
+        socks[i] = login(&address, i * 997);
+    }
+
+    for (int k = 0; k < (int) (sizeof(listings) / sizeof(listings[0])); k++) {
+        usleep(300000);             // Lets the other clients' deliveries settle
+        double start = server_cpu(pid);
+        run_listing(socks, listings[k], rounds);
+        printf("%-18s %8.1f us/command (server cpu)\n", listings[k], (server_cpu(pid) - start) / rounds * 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Login round-trip against a running server: connect, LOGIN, wait for the AUTH line, close.
+//
+//   gcc -O2 -o login_bench bench/login_bench.c
+//   ./server 9999 --io-model=epoll &
+//   ./login_bench 9999 [logins]
+//
+// The account benchlogin is registered first if it does not exist yet. Logins run one after the other
+// with a short pause between them so each one finds the server idle. Servers from before the AUTH status
+// line are measured up to their trailing ANSWER line, which is what the old client waited for.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define REPLY_SIZE 256
+
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// A reply is complete at the AUTH line, or at the ANSWER line older servers sent after their text
+bool reply_complete(const char *reply, int len) {
+    if (len == 0 || reply[len - 1] != '\n') {
+        return false;
+    }
+    return strncmp(reply, "AUTH ", 5) == 0 || (len >= 7 && strncmp(reply + len - 7, "ANSWER\n", 7) == 0);
+}
+
+// Sends one auth command on a fresh connection and reads the whole reply, returns the socket
+int authenticate(struct sockaddr_in *address, const char *command, char *reply) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) address, sizeof(*address)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    send(sock, command, strlen(command), 0);
+
+    int len = 0;
+    while (!reply_complete(reply, len)) {
+        int received = (int) recv(sock, reply + len, REPLY_SIZE - 1 - len, 0);
+        if (received <= 0) {
+            fprintf(stderr, "Server closed the connection during login\n");
+            exit(1);
+        }
+        len += received;
+        if (len == REPLY_SIZE - 1) {
+            fprintf(stderr, "Login reply does not fit in %d bytes\n", REPLY_SIZE);
+            exit(1);
+        }
+    }
+    reply[len] = '\0';
+    return sock;
+}
+
+int compare_samples(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: login_bench port [logins]\n");
+        return 0;
+    }
+    int logins = argc > 2 ? atoi(argv[2]) : 500;
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(atoi(argv[1]))};
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    char reply[REPLY_SIZE];
+    close(authenticate(&address, "REGISTER benchlogin pw\n", reply));
+    usleep(100000);
+
+    double *samples = malloc(logins * sizeof(double));
+    if (samples == NULL) {
+        perror("Failed to allocate samples");
+        return 1;
+    }
+    for (int i = 0; i < logins; i++) {
+        double start = bench_now();
+        int sock = authenticate(&address, "LOGIN benchlogin pw\n", reply);
+        samples[i] = bench_now() - start;
+        if (strncmp(reply, "AUTH 200", 8) != 0 && strstr(reply, "Login successful") == NULL) {
+            fprintf(stderr, "Login failed: %s", reply);
+            return 1;
+        }
+        close(sock);
+        usleep(2000);               // Lets the server log the previous session out
+    }
+
+    qsort(samples, logins, sizeof(double), compare_samples);
+    printf("%d logins: round-trip p50 %.0f us p90 %.0f us p99 %.0f us\n", logins, samples[logins / 2] * 1e6,
+           samples[logins * 9 / 10] * 1e6, samples[logins * 99 / 100] * 1e6);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Allocator calls and time for the moves of a 200-move game: the move log against the linked list it replaced.
+//
+//   gcc -O2 -pthread -o move_log_bench bench/move_log_bench.c
+//   ./move_log_bench [games]
+//
+// The server is compiled in with malloc, calloc, realloc and free counted, so the log side runs the real
+// initialize_game, add_move, finish_game and release_game. Counts are per game after the first one, which
+// is when the pools fill up.
+#define _GNU_SOURCE  // As in the server, whose headers come after these definitions
+#include <stdlib.h>
+
+long allocations;
+long frees;
+
+void *counted_malloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+void *counted_calloc(size_t count, size_t size) {
+    allocations++;
+    return calloc(count, size);
+}
+
+void *counted_realloc(void *ptr, size_t size) {
+    allocations++;
+    return realloc(ptr, size);
+}
+
+void counted_free(void *ptr) {
+    frees += ptr != NULL;
+    free(ptr);
+}
+
+#define main server_main
+#define malloc counted_malloc
+#define calloc counted_calloc
+#define realloc counted_realloc
+#define free counted_free
+#include "../socket_server.c"
+#undef main
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#define GAME_MOVES 200
+
+typedef struct ListMove {
+    int pit_index;
+    int seeds_before_move;
+    struct ListMove *next;
+} ListMove;
+
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// What add_move did before the log: a node per move, appended at the tail of the player's own list
+void list_add_move(ListMove **history, int pit_index, int seeds_before_move) {
+    ListMove *move = counted_malloc(sizeof(ListMove));
+    if (!move) {
+        perror("Failed to allocate memory for move");
+        exit(1);
+    }
+    move->pit_index = pit_index;
+    move->seeds_before_move = seeds_before_move;
+    move->next = NULL;
+
+    if (!*history) {
+        *history = move;
+    } else {
+        ListMove *current = *history;
+        while (current->next) {
+            current = current->next;
+        }
+        current->next = move;
+    }
+}
+
+void list_free(ListMove **history) {
+    while (*history != NULL) {
+        ListMove *next = (*history)->next;
+        counted_free(*history);
+        *history = next;
+    }
+}
+
+void report(const char *name, int games, long allocated, long freed, double seconds) {
+    printf("%-12s %6.1f allocations %6.1f frees per game, moves %6.2f us per game\n", name,
+           (double) allocated / (games - 1), (double) freed / (games - 1), seconds / games * 1e6);
+}
+
+int main(int argc, char **argv) {
+    int games = argc > 1 ? atoi(argv[1]) : 20000;
+    if (games < 2) {
+        printf("Usage: move_log_bench [games], at least 2\n");
+        return 0;
+    }
+
+    ListMove *histories[2] = {NULL, NULL};
+    long allocated = 0, freed = 0;
+    double seconds = 0;
+    for (int g = 0; g < games; g++) {
+        long allocations_before = allocations, frees_before = frees;
+        double start = bench_now();
+        for (int m = 0; m < GAME_MOVES; m++) {
+            list_add_move(&histories[m % 2], m % PITS, 4);
+        }
+        list_free(&histories[0]);
+        list_free(&histories[1]);
+        seconds += bench_now() - start;
+        if (g > 0) {
+            allocated += allocations - allocations_before;
+            freed += frees - frees_before;
+        }
+    }
+    report("linked list", games, allocated, freed, seconds);
+
+    // Players that are not connected, so the game's messages go nowhere
+    static Player player1 = {.pseudo = "bench1", .socket = -1};
+    static Player player2 = {.pseudo = "bench2", .socket = -1};
+    allocated = freed = 0;
+    seconds = 0;
+    for (int g = 0; g < games; g++) {
+        long allocations_before = allocations, frees_before = frees;
+        initialize_game(&player1, &player2);
+        Game *game = acquire_player_game(&player1);
+        double start = bench_now();
+        for (int m = 0; m < GAME_MOVES; m++) {
+            add_move(game, m % 2 ? &player2 : &player1, m % PITS, 4);
+        }
+        seconds += bench_now() - start;
+        finish_game(game);
+        release_game(game);
+        if (g > 0) {
+            allocated += allocations - allocations_before;
+            freed += frees - frees_before;
+        }
+    }
+    report("move log", games, allocated, freed, seconds);
+    return 0;
+}
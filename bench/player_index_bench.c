@@ -0,0 +1,73 @@
+// Lookup by pseudo through the player index against the linear scan it replaced.
+//
+//   gcc -O2 -pthread -o player_index_bench bench/player_index_bench.c
+//   ./player_index_bench
+//
+// The server is compiled in so the benchmark exercises the real find_player and player_index_insert.
+#define main server_main
+#include "../socket_server.c"
+#undef main
+
+#define SCAN_BUDGET 200000000L  // Pseudo comparisons the scan may spend per table size
+
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// What find_player did before the index: every slot compared in turn
+Player *scan_players(Player *players, int count, const char *pseudo, int len) {
+    for (int i = 0; i < count; i++) {
+        if (strncmp(players[i].pseudo, pseudo, len) == 0 && players[i].pseudo[len] == '\0') {
+            return &players[i];
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    int sizes[] = {1000, 100000, 1000000};
+
+    for (int k = 0; k < (int) (sizeof(sizes) / sizeof(sizes[0])); k++) {
+        int count = sizes[k];
+        free(player_index);
+        player_index = NULL;
+        player_index_capacity = 0;
+        player_index_count = 0;
+
+        Player *players = calloc(count, sizeof(Player));
+        if (players == NULL) {
+            perror("Failed to allocate players");
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
+            snprintf(players[i].pseudo, MAX_PSEUDO_LEN, "p%d", i % 10000000);  // Bounded for -Wformat-truncation
+            player_index_insert(&players[i]);
+        }
+
+        // Hits spread over the table, names formatted in the loop for both so the cost is comparable
+        char name[MAX_PSEUDO_LEN];
+        long hits = 0;
+        long scans = SCAN_BUDGET / count;
+        double start = bench_now();
+        for (long i = 0; i < scans; i++) {
+            int len = snprintf(name, sizeof(name), "p%d", (int) ((i * 2654435761u) % count));
+            hits += scan_players(players, count, name, len) != NULL;
+        }
+        double scan_ns = (bench_now() - start) / scans * 1e9;
+
+        long lookups = 2000000;
+        start = bench_now();
+        for (long i = 0; i < lookups; i++) {
+            int len = snprintf(name, sizeof(name), "p%d", (int) ((i * 2654435761u) % count));
+            hits += find_player(name, len) != NULL;
+        }
+        double index_ns = (bench_now() - start) / lookups * 1e9;
+
+        printf("%8d players: scan %12.0f ns/lookup, index %5.0f ns/lookup (%ld hits)\n",
+               count, scan_ns, index_ns, hits);
+        free(players);
+    }
+    return 0;
+}
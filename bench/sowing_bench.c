@@ -0,0 +1,221 @@
+// Sowing kernel: the packed, table-driven board against the per-seed loop over two int rows it replaced.
+//
+//   gcc -O2 -pthread -o sowing_bench bench/sowing_bench.c
+//   ./sowing_bench [moves]
+//
+// The server is compiled in so the benchmark runs the real distribute_seeds, capture_seeds and is_game_over.
+// It first plays single moves on random boards, heavy pits included so sows go around several laps, and
+// checks that both kernels leave the same pits and stores and agree on the end of the game. It then plays
+// the same random games with each kernel on one core and reports moves per second.
+#define main server_main
+#include "../socket_server.c"
+#undef main
+
+#define CHECKED_BOARDS 2000000
+#define CHOICES (1 << 16)          // Pit choices replayed by both kernels, so they play the same games
+
+// The board before it was packed: a row of pits and a store per side
+typedef struct {
+    int pits[2][PITS];
+    int store[2];
+} LoopState;
+
+unsigned choices[CHOICES];
+uint64_t random_state = 88172645463325252ull;
+
+double bench_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+unsigned next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (unsigned) random_state;
+}
+
+void loop_capture_seeds(LoopState *state, int side, int last_pit) {
+    int *opponent_pits = state->pits[1 - side];
+    int captured_seeds = 0;
+    while (last_pit >= 0 && (opponent_pits[last_pit] == 2 || opponent_pits[last_pit] == 3)) {
+        captured_seeds += opponent_pits[last_pit];
+        opponent_pits[last_pit] = 0;
+        last_pit--;
+    }
+    state->store[side] += captured_seeds;
+}
+
+// What distribute_seeds did before the packed board: one seed at a time, row by row
+void loop_distribute_seeds(LoopState *state, int side, int pit_index) {
+    int *own = state->pits[side];
+    int *other = state->pits[1 - side];
+    int curr_pit = pit_index;
+    int seeds = own[pit_index];
+    own[pit_index] = 0;
+
+    while (1) {
+        for (; curr_pit < PITS && seeds > 0; curr_pit++) {
+            if (pit_index == curr_pit) continue;
+            seeds--;
+            own[curr_pit]++;
+        }
+        if (seeds == 0) break;
+        curr_pit = 0;
+        for (; curr_pit < PITS && seeds > 0; curr_pit++) {
+            seeds--;
+            other[curr_pit]++;
+            if (seeds == 0) {
+                loop_capture_seeds(state, side, curr_pit);
+            }
+        }
+        curr_pit = 0;
+        if (seeds == 0) break;
+    }
+}
+
+int loop_dead(const int *pits) {
+    for (int i = 0; i < PITS; i++) {
+        if (pits[i] > 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int loop_is_savior(const int *pits) {
+    int total_seeds = 0;
+    for (int i = 0; i < PITS; i++) {
+        total_seeds += pits[i];
+    }
+    return total_seeds > 1;
+}
+
+int loop_is_game_over(const LoopState *state) {
+    if (state->store[0] >= 25 || state->store[1] >= 25) {
+        return 1;
+    }
+    if (loop_dead(state->pits[0]) && !loop_is_savior(state->pits[1])) {
+        return 1;
+    }
+    if (loop_dead(state->pits[1]) && !loop_is_savior(state->pits[0])) {
+        return 1;
+    }
+    return 0;
+}
+
+// Plays one move from the same random board with both kernels, false if they disagree
+bool check_random_board() {
+    LoopState loop;
+    GameState packed;
+    memset(&packed, 0, sizeof(packed));
+    int left = 2 * PITS * INITIAL_SEEDS;
+    for (int c = 0; c < BOARD_PITS; c++) {
+        int seeds = left > 0 ? (int) (next_random() % (left + 1) % 24) : 0;
+        left -= seeds;
+        loop.pits[c / PITS][c % PITS] = seeds;
+        packed.pit[c] = (uint8_t) seeds;
+    }
+    loop.store[0] = packed.pit[BOARD_STORE(0)] = (uint8_t) (left / 2);
+    loop.store[1] = packed.pit[BOARD_STORE(1)] = (uint8_t) (left - left / 2);
+
+    int side = (int) (next_random() & 1);
+    int pit = (int) (next_random() % PITS);
+    if (loop.pits[side][pit] == 0) {
+        return true;
+    }
+    loop_distribute_seeds(&loop, side, pit);
+    capture_seeds(&packed, side, distribute_seeds(&packed, side, pit));
+
+    for (int c = 0; c < BOARD_PITS; c++) {
+        if (loop.pits[c / PITS][c % PITS] != packed.pit[c]) {
+            return false;
+        }
+    }
+    return loop.store[0] == packed.pit[BOARD_STORE(0)] && loop.store[1] == packed.pit[BOARD_STORE(1)] &&
+           loop_is_game_over(&loop) == is_game_over(&packed);
+}
+
+// Both players take the chosen pit, or the next non-empty one; a side with nothing to play ends the game
+double loop_moves_per_second(long moves) {
+    LoopState state;
+    unsigned k = 0;
+    int side = 0;
+    double start = bench_now();
+    for (long m = 0; m < moves;) {
+        for (int s = 0; s < 2; s++) {
+            for (int i = 0; i < PITS; i++) {
+                state.pits[s][i] = INITIAL_SEEDS;
+            }
+            state.store[s] = 0;
+        }
+        for (;;) {
+            int pit = (int) (choices[k++ % CHOICES] % PITS);
+            for (int i = 0; i < PITS && state.pits[side][pit] == 0; i++) {
+                pit = (pit + 1) % PITS;
+            }
+            if (state.pits[side][pit] == 0) {
+                break;
+            }
+            loop_distribute_seeds(&state, side, pit);
+            m++;
+            side ^= 1;
+            if (loop_is_game_over(&state)) {
+                break;
+            }
+        }
+    }
+    return moves / (bench_now() - start);
+}
+
+double packed_moves_per_second(long moves) {
+    GameState state;
+    unsigned k = 0;
+    int side = 0;
+    double start = bench_now();
+    for (long m = 0; m < moves;) {
+        memset(&state, 0, sizeof(state));
+        memset(state.pit, INITIAL_SEEDS, BOARD_PITS);
+        for (;;) {
+            const uint8_t *row = &state.pit[side * PITS];
+            int pit = (int) (choices[k++ % CHOICES] % PITS);
+            for (int i = 0; i < PITS && row[pit] == 0; i++) {
+                pit = (pit + 1) % PITS;
+            }
+            if (row[pit] == 0) {
+                break;
+            }
+            capture_seeds(&state, side, distribute_seeds(&state, side, pit));
+            m++;
+            side ^= 1;
+            if (is_game_over(&state)) {
+                break;
+            }
+        }
+    }
+    return moves / (bench_now() - start);
+}
+
+int main(int argc, char **argv) {
+    long moves = argc > 1 ? atol(argv[1]) : 20000000;
+    init_sowing_tables();
+
+    for (int t = 0; t < CHECKED_BOARDS; t++) {
+        if (!check_random_board()) {
+            printf("Kernels disagree on random board %d\n", t);
+            return 1;
+        }
+    }
+    printf("Kernels agree on %d random boards\n", CHECKED_BOARDS);
+
+    for (int i = 0; i < CHOICES; i++) {
+        choices[i] = next_random();
+    }
+    for (int round = 0; round < 3; round++) {
+        double loop = loop_moves_per_second(moves);
+        double packed = packed_moves_per_second(moves);
+        printf("loop kernel %.1f M moves/s, packed kernel %.1f M moves/s\n", loop / 1e6, packed / 1e6);
+    }
+    return 0;
+}
@@ -15,13 +15,16 @@
 #define MAX_BIO_LINES 10
 #define MAX_BIO_LINE_LENGTH 80 // https://en.wikipedia.org/wiki/Characters_per_line
 
+#define AUTH_LOGGED_IN 200
+#define AUTH_REGISTERED 201
+
 int logged_in = 0;
-int answer_received = 0;
+int answer_received = 0;  // Guarded by auth_mutex, set when the AUTH status line arrives
+
+pthread_mutex_t auth_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t auth_cond = PTHREAD_COND_INITIALIZER;
 
-char *answer = "ANSWER\n";
-char *login_success = "Login successful!\n";
-char *reg_success = "Registration successful!\n";
-char *logged_out = "Logging out...\n";
+char *logged_out = "Logging out...";
 
 
 const char *LOGOUT = "LOGOUT\n";
@@ -69,6 +72,8 @@ int login_or_register(int server_socket);
 
 void *listen_to_server(void *arg);
 
+void handle_server_line(char *line);
+
 void *handle_user_commands(int server_socket);
 
 void handle_help();
@@ -217,17 +222,21 @@ int login_or_register(int server_socket) {
                 snprintf(command, BUFFER_SIZE, "REGISTER %s %s\n", pseudo, password);
             }
 
+            pthread_mutex_lock(&auth_mutex);
+            answer_received = 0;
+            pthread_mutex_unlock(&auth_mutex);
+
             if (send_message(server_socket, command) < 0) {
                 perror("Failed to send login/register request");
                 continue;
-            } else {
-                answer_received = 0;
             }
 
-            // Wait until login is successful before proceeding
+            // Wait for the status line before prompting again
+            pthread_mutex_lock(&auth_mutex);
             while (!answer_received) {
-                usleep(100);  // Sleep for a short time before checking again
+                pthread_cond_wait(&auth_cond, &auth_mutex);
             }
+            pthread_mutex_unlock(&auth_mutex);
         } else {
             printf("Unknown command. Please use /l for login or /r for registration.\n");
         }
@@ -242,21 +251,29 @@ int login_or_register(int server_socket) {
 void *listen_to_server(void *arg) {
     int server_socket = *(int *) arg;
     char buffer[BUFFER_SIZE];
+    size_t used = 0;
     ssize_t bytes_received;
 
-    while ((bytes_received = recv(server_socket, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytes_received] = '\0'; // Null-terminate the received message
-        // Check for successful login message
+    // Messages may arrive split or coalesced, handle them one line at a time
+    while ((bytes_received = recv(server_socket, buffer + used, BUFFER_SIZE - 1 - used, 0)) > 0) {
+        used += bytes_received;
+        buffer[used] = '\0';
+
+        char *line = buffer;
+        char *newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            handle_server_line(line);
+            line = newline + 1;
+        }
 
-        if (strcmp(buffer, answer) == 0) {
-            answer_received = 1;
-        } else if (strcmp(buffer, login_success) == 0 || strcmp(reg_success, buffer) == 0) {
-            logged_in = 1;  // Set login status to true
-        } else if (strcmp(buffer, logged_out) == 0) {
-            logged_in = 0;
-            exit(0);
+        used -= line - buffer;
+        if (used == BUFFER_SIZE - 1) {
+            // No newline in a full buffer, show it as is
+            handle_server_line(buffer);
+            used = 0;
         } else {
-            printf("%s", buffer); // Display any other server messages
+            memmove(buffer, line, used);
         }
     }
 
@@ -270,6 +287,28 @@ void *listen_to_server(void *arg) {
     }
 }
 
+void handle_server_line(char *line) {
+    int code;
+    int offset;
+
+    if (sscanf(line, "AUTH %d %n", &code, &offset) == 1) {
+        pthread_mutex_lock(&auth_mutex);
+        if (code == AUTH_LOGGED_IN || code == AUTH_REGISTERED) {
+            logged_in = 1;  // Set login status to true
+        } else {
+            printf("%s\n", line + offset);
+        }
+        answer_received = 1;
+        pthread_cond_signal(&auth_cond);
+        pthread_mutex_unlock(&auth_mutex);
+    } else if (strcmp(line, logged_out) == 0) {
+        logged_in = 0;
+        exit(0);
+    } else {
+        printf("%s\n", line); // Display any other server messages
+    }
+}
+
 // Function to handle user commands
 void *handle_user_commands(int server_socket) {
 
@@ -620,7 +659,7 @@ void handle_game_message(int server_socket, const char *command) {
 
         // Prepare the buffer to send
         char buffer[1024];  // Adjust size as needed
-        snprintf(buffer, sizeof(buffer), "GAME_MESSAGE %s\0", message);
+        snprintf(buffer, sizeof(buffer), "GAME_MESSAGE %s\n", message);
 
         // Send the message
         send_message(server_socket, buffer);
@@ -1,14 +1,40 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <sched.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
 
 #define LOGOUT "LOGOUT"
 #define SHOW_ONLINE "SHOW_ONLINE"
@@ -39,17 +65,41 @@
 #define MAKE_MOVE "MAKE_MOVE"
 #define LEAVE_GAME "LEAVE_GAME"
 #define SAVE "SAVE"
+#define MY_GAMES "MY_GAMES"
+#define SWITCH_GAME "SWITCH_GAME"
+#define STATS "STATS"
 
 
 #define MAX_ONLINE_PLAYERS 100
-#define MAX_PLAYERS 1000
+#define PLAYER_CHUNK_SHIFT 10      // 1024 players per registry chunk
+#define PLAYER_CHUNK_SIZE (1 << PLAYER_CHUNK_SHIFT)
+#define MAX_PLAYER_CHUNKS 4096      // Registry ceiling of 4M accounts, chunks are allocated as they fill
+#define MAX_OBSERVERS 1000
+#define OBSERVER_CLASSES 4               // Observer array sizes, see observer_pools
+#define TOP_PLAYERS 10
 #define MAX_FRIENDS 20
-#define MAX_GAMES 50
+#define GAME_TABLE_INITIAL 64           // Slots of the game table before it first doubles
+#define MAX_PLAYER_GAMES 64             // Games one player can have going at once
 #define BUFFER_SIZE 1024
-#define PLAYER_FILE "players.txt"
-#define GAMES_FILE "games.txt"
+#define PLAYER_FILE "players.txt"          // Text accounts of older servers, loaded while there is no snapshot
+#define PLAYER_SNAPSHOT "players.bin"     // Binary snapshot written by compaction
+#define PLAYER_JOURNAL "players.journal"  // Profile changes since the snapshot, one line each
+#define SNAPSHOT_MAGIC 0x504c5741u        // "AWLP"
+#define SNAPSHOT_VERSION 2                // 1 had no game results, they are counted from the archive once
+#define JOURNAL_COMPACT_MIN 4096          // Records before compacting, or one per account if more
+#define DEFAULT_FLUSH_INTERVAL_MS 20      // Longest a batched record waits for company before it is written
+#define DEFAULT_FLUSH_BATCH 256           // Queued records that trigger a write without waiting
+#define GAMES_FILE "games.txt"            // Text games of older servers, moved into the archive by --import-games
+#define GAME_ARCHIVE "games.bin"          // Every saved game: its GameRecord followed by its moves
+#define GAME_INDEX "games.idx"            // A copy of each archived GameRecord, in archive order
+#define GAME_RECORD_MAGIC 0x474d4147u     // "GAMG"
+#define MOVE_BY_PLAYER2 0x80              // Set on the pit byte of a move played by player2
+#define MOVE_LOG_INITIAL 256              // Moves a game's log holds before it doubles
 #define PITS 6  // Number of pits per player
 #define INITIAL_SEEDS 4  // Initial seeds in each pit
+#define BOARD_PITS (2 * PITS)            // Both rows of a packed board, side s starting at s * PITS
+#define BOARD_STORE(side) (BOARD_PITS + (side))
+#define SOW_CYCLE (BOARD_PITS - 1)      // Pits one lap of sowing fills, every one but the emptied pit
 
 #define MAX_PSEUDO_LEN 11
 #define MAX_PASSWORD_LEN 10
@@ -59,73 +109,677 @@
 
 #define HASH_SIZE 256
 
-
-typedef struct Move {
-    int pit_index;            // Pit index of the move
-    int seeds_before_move;    // Seeds in the pit before the move
-    struct Move *next;        // Pointer to the next move in the list
-} Move;
-
+#define DEFAULT_WORKERS 4
+#define MAX_EPOLL_EVENTS 256
+#define MAX_CONNECTIONS (1 << 20)  // Upper bound on descriptors tracked by the reactor
+#define READ_BUDGET 16             // Reads served per connection before yielding the worker
+
+#define INPUT_BUFFER_SIZE 4096     // Per-connection input ring, power of two; holds a partial frame plus one read
+#define OUTPUT_CHUNK_SIZE 4096
+#define OUTPUT_QUEUE_LIMIT (256 * 1024)  // Queued bytes before a client is considered stuck
+#define OUTPUT_MAX_IOV 64          // Chunks gathered by one writev
+#define DIRTY_LIMIT 256            // Connections a thread batches before flushing early
+#define FRAME_HEADER 3             // u16 length of type and payload, big endian, then u8 type
+#define FRAME_MAX 65535
+#define LOGIN_BINARY "BINARY"      // Optional last LOGIN/REGISTER argument selecting framed messages
+
+#define URING_ENTRIES 4096
+#define URING_BUFFERS 1024         // Provided recv buffers of BUFFER_SIZE bytes, power of two
+#define URING_BUFFER_GROUP 0
+
+#define MAX_ARGS 4                 // Arguments kept as slices, later ones are only counted
+#define COMMAND_TABLE_SIZE 128     // Power of two, roomy enough for a collision-free seed to turn up fast
+#define CMD_NEEDS_GAME 1u          // Rejected unless the player is in a game
+#define PLAYER_INDEX_INITIAL 1024  // Power of two, doubled once the index is 70% full
+#define LISTING_KINDS 5
+#define LISTING_BYTES (FRAME_MAX + MAX_PSEUDO_LEN)  // Pseudo bytes a snapshot keeps, a reply never carries more
+#define LISTING_BIT(kind) (1u << (kind))
+
+// Low bits of io_uring user_data, the rest is the Connection pointer
+#define URING_IGNORE 0ULL
+#define URING_ACCEPT 1ULL
+#define URING_RECV 2ULL
+#define URING_SEND 3ULL
+#define URING_WAKE 4ULL            // Another ring handed over sockets to flush
+#define URING_TAG_MASK 7ULL
+
+// Names a game: its slot in game_slots in the low 32 bits, the slot's generation above. A handle kept after
+// the game ended never matches the game that reuses the slot.
+typedef uint64_t GameHandle;
+
+#define NO_GAME 0  // Generations start at 1, so no game ever gets this handle
+#define GAME_SLOT(handle) ((uint32_t) (handle))
+#define GAME_GENERATION(handle) ((uint32_t) ((handle) >> 32))
+
+// Account data only read by a few commands, kept out of Player so registry scans stay small
 typedef struct {
-    int socket;
-
-    char pseudo[MAX_PSEUDO_LEN];
+    pthread_mutex_t lock;         // Guards this profile and the owner's private flag
     char password[HASH_SIZE];
-
-    bool is_online;
-    bool private;
     char bio[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH];
     char friends[MAX_FRIENDS][MAX_PSEUDO_LEN];
     int friend_count;
+} PlayerProfile;
 
-    int pits[PITS];
-    int store;
-
-    int win_count;
-
-    Move *move_history;
-    char observing[MAX_PSEUDO_LEN];
-    int game_id;
+typedef struct {
+    // Fields read by listings and broadcasts first, so a scan touches one cache line per player
+    bool is_online;
+    bool private;
+    int socket;
+    char pseudo[MAX_PSEUDO_LEN];
+    int win_count;                // Results of saved games, kept with the account
+    int loss_count;
+    int draw_count;
+    int game_count;               // Games the player is in, read without games_lock only as a hint
+    GameHandle current_game;      // Where game commands go, NO_GAME when not playing
+    int online_index;             // Position in online_set, -1 while offline
+    int snapshot_record;          // Record in the mapped snapshot not yet copied into profile, -1 once it is
+    PlayerProfile *profile;       // Go through lock_profile, which fills it from the snapshot on first use
+    GameHandle *games;            // game_count handles, guarded by games_lock like current_game
+    int game_capacity;
+
+    GameHandle observing;         // Game being watched, NO_GAME when none, only a hint until that game is locked
     char challenged_by[MAX_PSEUDO_LEN];
     char challenged[MAX_PSEUDO_LEN];
 } Player;
 
+typedef uint8_t BoardVector __attribute__((vector_size(16)));
+
+// Board of one game in one vector: side 0's pits, side 1's pits, both stores, two unused bytes.
+// Side 0 is player1's. All 48 seeds fit any one byte, so whole-board adds never carry.
+typedef union {
+    BoardVector cells;
+    uint8_t pit[16];
+} GameState;
+
 typedef struct {
     Player *player1;
     Player *player2;
+    GameState state;
     char current_turn[MAX_PSEUDO_LEN];
-    Player *observers[MAX_PLAYERS];
+    Player **observers;           // From the observer_pools class of observer_capacity, NULL until the first
     int observer_count;
+    int observer_capacity;
     bool save_on_exit;
+    time_t started;
+    unsigned char *moves;         // Every move in the order played, in the GAME_ARCHIVE move format
+    int move_count;
+    int move_capacity;            // MOVE_LOG_INITIAL moves come from move_log_pool, longer logs from malloc
+
+    pthread_mutex_t lock;         // Guards everything above
+    GameHandle handle;            // Its entry in game_slots
+    int refs;                     // The table's reference plus one per acquire_game, updated atomically
+    bool finished;                // Set under lock, the game leaves the table on its last release
+    bool unlinked;
+    unsigned long persist_sequence;  // Last record queued for the game's end, release_game waits for it unlocked
 } Game;
 
+// Entry of the game table, on the free list while game is NULL
+typedef struct {
+    Game *game;
+    uint32_t generation;          // Bumped every time the slot is freed
+    int next_free;                // Next free slot, -1 at the end of the list
+} GameSlot;
+
 typedef struct {
     Player *player1;
     Player *player2;
 } Challenge;
 
-Player players[MAX_PLAYERS];
-Game *active_games[MAX_GAMES];
+// Text inside the command line, not NUL terminated unless it runs to the end of the line
+typedef struct {
+    const char *ptr;
+    int len;
+} Slice;
+
+// A command split in place, the slices point into the line held by the input buffer
+typedef struct {
+    Slice name;
+    Slice args[MAX_ARGS];
+    int argc;                     // Every argument, including those beyond MAX_ARGS
+    const char *end;              // Terminating NUL of the line
+} Command;
+
+// One entry per protocol command, looked up through a perfect hash of the command word
+typedef struct {
+    const char *name;
+    void (*handler)(Player *player);                     // Commands without arguments
+    void (*handler_args)(Player *player, Command *cmd);  // Handlers reading the tokenized arguments
+    int arity;                    // Minimum number of arguments after the command word
+    unsigned flags;
+    const char *usage;
+    unsigned long calls;          // Updated atomically, reported by STATS
+} CommandSpec;
+
+// Open-addressing slot of the pseudo index, player is NULL when the slot is free
+typedef struct {
+    unsigned hash;
+    Player *player;
+} PlayerIndexEntry;
+
+typedef enum {
+    IO_MODEL_THREADS,  // One blocking thread per client
+    IO_MODEL_EPOLL,    // Edge-triggered reactor feeding a worker pool
+    IO_MODEL_URING     // io_uring completions handled on the ring thread
+} IoModel;
+
+// How far the persistence thread goes before a queued record counts as saved
+typedef enum {
+    DURABILITY_NONE,        // Written as soon as possible, never fsynced
+    DURABILITY_BATCHED,     // Group commit: one write and fsync per interval or full batch
+    DURABILITY_EVERY_WRITE  // Writers wait until their record is fsynced, concurrent writers share the fsync
+} Durability;
+
+typedef enum {
+    PERSIST_PLAYERS,  // A PLAYER_JOURNAL line
+    PERSIST_GAMES     // A GameRecord and its moves for GAME_ARCHIVE
+} PersistTarget;
+
+// Data waiting for the persistence thread
+typedef struct PersistRecord {
+    struct PersistRecord *next;
+    PersistTarget target;
+    int len;
+    char data[];
+} PersistRecord;
+
+typedef enum {
+    CONN_IDLE,     // Waiting for the reactor to report input
+    CONN_QUEUED,   // Sitting in the worker queue
+    CONN_RUNNING,  // Being served by a worker
+    CONN_RERUN     // Input arrived while running, serve again before going idle
+} ConnectionState;
+
+// Result codes of the "AUTH <code> <text>" line answering LOGIN and REGISTER
+typedef enum {
+    AUTH_LOGGED_IN = 200,
+    AUTH_REGISTERED = 201,
+    AUTH_BAD_REQUEST = 400,
+    AUTH_BAD_PASSWORD = 401,
+    AUTH_NOT_FOUND = 404,
+    AUTH_CONFLICT = 409,     // Already online or pseudo taken
+    AUTH_SERVER_FULL = 503
+} AuthResult;
+
+// Frame types of the binary protocol, the payload layout is given for each
+typedef enum {
+    MSG_TEXT = 1,     // Reply without a dedicated type: the text
+    MSG_COMMAND = 2,  // Client command in text form, without the newline
+    MSG_MOVE = 3,     // From the client: u8 pit 1..6. From the server: u8 pit, then the mover's pseudo
+    MSG_BOARD = 4,    // 6 pits and store of the recipient's side, then of the other side, u8 each
+    MSG_CHAT = 5,     // u8 ChatChannel, sender pseudo, then the text
+    MSG_LISTING = 6,  // u8 ListingKind, u16 count, then the entries
+    MSG_ERROR = 7     // The error text
+} MessageType;
+
+typedef enum {
+    CHAT_GLOBAL,
+    CHAT_GAME,
+    CHAT_DIRECT
+} ChatChannel;
+
+// Entries are pseudos, TOP listings add a u16 win count, GAMES list both players
+typedef enum {
+    LISTING_ONLINE,
+    LISTING_PLAYERS,
+    LISTING_GAMES,
+    LISTING_TOP,
+    LISTING_TOP_ONLINE
+} ListingKind;
+
+// Start of PLAYER_SNAPSHOT, integers are in the byte order of the machine that wrote it
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;         // sizeof(SnapshotPlayer) of the writer
+    uint32_t count;
+    uint64_t extra_offset;        // Variable area, after the table of count records
+    uint64_t extra_size;
+} SnapshotHeader;
+
+// Fixed-size account record, its password, friends and bio live in the variable area at extra
+typedef struct {
+    char pseudo[MAX_PSEUDO_LEN];  // NUL padded
+    uint8_t private;
+    uint8_t friend_count;         // MAX_PSEUDO_LEN bytes each, after the password
+    uint8_t password_len;
+    uint16_t bio_len;             // After the friends, not NUL terminated
+    uint64_t extra;
+    uint32_t wins;                // Version 2 onwards
+    uint32_t losses;
+    uint32_t draws;
+} SnapshotPlayer;
+
+typedef enum {
+    GAME_RESULT_TIE,
+    GAME_RESULT_PLAYER1,
+    GAME_RESULT_PLAYER2
+} GameResult;
+
+// Fixed header of an archived game, followed in GAME_ARCHIVE by move_count moves of two bytes: the pit,
+// with MOVE_BY_PLAYER2 set for the second player, then the seeds it held. GAME_INDEX holds the headers alone.
+typedef struct {
+    uint32_t magic;
+    uint16_t move_count;
+    uint8_t result;               // GameResult
+    uint8_t unused;
+    char player1[MAX_PSEUDO_LEN]; // NUL padded
+    char player2[MAX_PSEUDO_LEN];
+    int64_t started;              // Unix seconds, 0 for imported games
+    int64_t ended;
+    uint64_t offset;              // Of this header in GAME_ARCHIVE, filled in by the persistence thread
+} GameRecord;
+
+#define ARCHIVED_GAME_SIZE(record) (sizeof(GameRecord) + 2 * (uint64_t) (record)->move_count)
+
+// Part of GAME_INDEX counted by one rebuild thread
+typedef struct {
+    const GameRecord *records;
+    size_t count;
+} ArchiveSlice;
+
+// Read-only copy of what a listing command shows
+typedef struct {
+    char pseudo[MAX_PSEUDO_LEN];
+    int win_count;
+} ListingEntry;
+
+// Snapshot published for one ListingKind, never modified once readers can see it
+typedef struct {
+    int count;
+    ListingEntry entries[];       // GAMES snapshots hold the two players of a game in consecutive entries
+} Listing;
+
+// Outgoing binary message, strings inside are a u8 length followed by the bytes
+typedef struct {
+    int len;
+    unsigned char data[FRAME_MAX + 2];
+} Frame;
+
+typedef enum {
+    SERVE_DRAINED,  // Socket returned EAGAIN
+    SERVE_BUDGET,   // Read budget exhausted, more input may be pending
+    SERVE_CLOSED    // Connection was closed and freed
+} ServeResult;
+
+// Bytes received but not yet dispatched, commands are framed by '\n'
+typedef struct {
+    unsigned head;                // First unconsumed byte, free-running
+    unsigned tail;                // One past the last received byte, free-running
+    unsigned scanned;             // Bytes after head already searched for a newline
+    bool discarding;              // Skipping the rest of an overlong line
+    char data[INPUT_BUFFER_SIZE];
+} InputBuffer;
+
+// Bytes produced for a client but not yet written
+typedef struct OutputChunk {
+    struct OutputChunk *next;
+    unsigned start;               // First unsent byte
+    unsigned end;                 // One past the last queued byte
+    char data[OUTPUT_CHUNK_SIZE];
+} OutputChunk;
+
+struct Shard;
+
+typedef struct Connection {
+    int socket;
+    struct Shard *shard;          // Listener that accepted it, owns its event loop
+    Player *player;               // NULL until LOGIN/REGISTER succeeds
+    InputBuffer *input;           // Allocated while a partial command is pending
+    ConnectionState state;        // Guarded by work_mutex
+    struct Connection *next;      // Link in the worker queue
+
+    // Outbound queue, guarded by out_lock
+    pthread_mutex_t out_lock;
+    OutputChunk *out_head;
+    OutputChunk *out_tail;
+    size_t out_bytes;
+    bool flush_pending;           // Listed in some thread's dirty set
+    bool out_failed;              // Write error or queue limit hit, further output is dropped
+    bool binary;                  // Negotiated at login, messages are framed instead of text
+
+    // io_uring backend, only touched by the ring thread
+    bool recv_armed;              // Multishot recv outstanding
+    bool closing;                 // Close once recv and the last send have completed
+    bool send_in_flight;
+    struct msghdr send_msg;       // Must outlive the SENDMSG it describes
+    struct iovec send_iov[OUTPUT_MAX_IOV];
+} Connection;
+
+#ifdef HAVE_IO_URING
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;            // Next SQE slot to fill
+    unsigned submitted;           // SQEs already handed to the kernel
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    unsigned short buf_tail;
+} Uring;
+#endif
+
+// One SO_REUSEPORT listener and the event loop serving the connections it accepted
+typedef struct Shard {
+    int id;
+    int listen_fd;
+    int epoll_fd;                 // Reactor instance, epoll model only
+    int workers;
+    Connection *work_head;        // Worker queue, guarded by work_mutex
+    Connection *work_tail;
+    pthread_mutex_t work_mutex;
+    pthread_cond_t work_cond;
+    int connection_count;         // Updated atomically
+#ifdef HAVE_IO_URING
+    Uring uring;
+    pthread_mutex_t flush_mutex;  // Guards the sockets other rings asked this one to flush
+    int *flush_sockets;
+    int flush_count;
+    int flush_capacity;
+    bool wake_pending;            // A MSG_RING wake-up is already on its way
+#endif
+} Shard;
+
+// Fixed-size blocks carved out of slabs and recycled through a free list, slabs are never returned. Keeps
+// game starts and ends away from the system allocator once the pool has grown to the busiest load seen.
+typedef struct {
+    const char *name;
+    size_t block_size;
+    int blocks_per_slab;
+    pthread_mutex_t lock;
+    void *free_list;              // Each free block starts with the next one
+    int in_use;
+    int peak;
+    int blocks;                   // Carved so far, in use or free
+    int slabs;
+} Pool;
+
+#define POOL_INITIALIZER(name, block_size, blocks_per_slab) \
+    {name, block_size, blocks_per_slab, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0}
+
+Player *player_chunks[MAX_PLAYER_CHUNKS];  // Chunks never move nor get freed, Player pointers stay valid
+PlayerProfile *profile_chunks[MAX_PLAYER_CHUNKS];  // Cold halves, same layout as player_chunks
+int player_count;  // Slots 0..player_count-1 are in use, written under registry_mutex, read atomically
+
+Player **online_set;  // Logged-in players in no particular order, guarded by registry_mutex
+int online_set_count;
+int online_set_capacity;
+GameSlot *game_slots;      // Grows by doubling, guarded by games_lock like the rest of the table
+int game_slot_count;       // Slots allocated, free or not
+int game_free_slot = -1;   // Head of the free slot list
 int active_game_count = 0;
-pthread_mutex_t player_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+Pool game_pool = POOL_INITIALIZER("games", sizeof(Game), 64);
+Pool move_log_pool = POOL_INITIALIZER("move logs", 2 * MOVE_LOG_INITIAL, 64);
+Pool observer_pools[OBSERVER_CLASSES] = {
+        POOL_INITIALIZER("observers 4", 4 * sizeof(Player *), 64),
+        POOL_INITIALIZER("observers 32", 32 * sizeof(Player *), 16),
+        POOL_INITIALIZER("observers 256", 256 * sizeof(Player *), 4),
+        POOL_INITIALIZER("observers 1000", MAX_OBSERVERS * sizeof(Player *), 1),
+};
+
+// Sowing from a pit, built once by init_sowing_tables; the origin indexes the packed board
+BoardVector sow_lap[BOARD_PITS];                 // A seed in every pit but the origin
+BoardVector sow_rest[BOARD_PITS][SOW_CYCLE];     // A seed in each of the first n pits after the origin
+uint8_t sow_last[BOARD_PITS][SOW_CYCLE];         // Pit the last seed lands in, by seeds % SOW_CYCLE
+// Lock order, outermost first; a lock is never requested while one further down the list is held:
+//   listing_build_locks one rebuild of each listing snapshot at a time
+//   registry_mutex      logins, registrations, logouts, online_set
+//   games_lock          the game table, which games occupy game_slots, every player's games and current_game
+//   Game.lock           one game's board, turn, observers and move history
+//   PlayerProfile.lock  one player's bio, friends and private flag
+//   challenge_mutex     challenged / challenged_by of every player, pairs change together
+//   leaf locks          player_index_lock, persist_mutex, listing_publish_mutex, connections_lock,
+//                       Connection.out_lock, Pool.lock
+// Moves only take their own Game.lock, so games never contend with each other.
+// persist_record may wait for the persistence thread, which takes every PlayerProfile.lock to compact the
+// journal, so it is never called with a Game.lock or PlayerProfile.lock held; queue_record only takes
+// persist_mutex and the wait comes after those locks are released.
+pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_rwlock_t games_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_mutex_t challenge_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Disk writes are queued for one persistence thread, which alone touches these files after startup
+FILE *journal_file;  // PLAYER_JOURNAL opened for appending
+FILE *game_archive;  // GAME_ARCHIVE opened for appending
+FILE *game_index;    // GAME_INDEX opened for appending
+uint64_t game_archive_size;  // Where the next archived game starts
+int journal_records;  // Records in the journal since the last compaction
+
+// PLAYER_SNAPSHOT as loaded at startup, mapped for the server's lifetime so profiles are copied out only when
+// used. Compaction renames a new file over it, the mapping keeps the old one readable.
+const unsigned char *snapshot_records;
+uint32_t snapshot_record_size;  // Smaller than SnapshotPlayer for version 1, which ends before wins
+const unsigned char *snapshot_extra;
+bool results_loaded;            // Game results came with the accounts, the archive need not be counted
+Durability durability = DURABILITY_BATCHED;
+int flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+int flush_batch = DEFAULT_FLUSH_BATCH;
+
+// Queue of records plus what STATS reports, guarded by persist_mutex
+pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t persist_cond = PTHREAD_COND_INITIALIZER;       // Records queued
+pthread_cond_t persist_done_cond = PTHREAD_COND_INITIALIZER;  // A flush completed
+PersistRecord *persist_head;
+PersistRecord *persist_tail;
+int persist_depth;
+int persist_peak_depth;
+unsigned long persist_queued;     // Sequence number of the last queued record
+unsigned long persist_committed;  // Every record up to this one is written (and fsynced unless DURABILITY_NONE)
+unsigned long persist_flushes;
+long persist_last_flush_us;
+long persist_max_flush_us;
+
+// Listing commands read these snapshots inside an epoch instead of locking the registry or the games.
+// A reader joins the counter of the current epoch parity; publishing a snapshot flips the parity and
+// waits for the counter of the old one to drain before freeing what it replaced.
+Listing *listings[LISTING_KINDS];
+unsigned long listing_versions[LISTING_KINDS];  // Bumped atomically after every change a listing shows
+unsigned long listing_built[LISTING_KINDS];     // Version the published snapshot was collected at
+pthread_mutex_t listing_build_locks[LISTING_KINDS] = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+};
+pthread_mutex_t listing_publish_mutex = PTHREAD_MUTEX_INITIALIZER;  // One grace period at a time
+unsigned long listing_epoch;
+long listing_readers[2];
+
+PlayerIndexEntry *player_index;  // Pseudo -> player, linear probing, guarded by player_index_lock
+int player_index_capacity;
+int player_index_count;
+pthread_rwlock_t player_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+IoModel io_model = IO_MODEL_EPOLL;
+int worker_count = DEFAULT_WORKERS;
+int shard_count = 1;
+
+Shard *shards;
+Connection **connections;   // Indexed by socket descriptor, guarded by connections_lock
+pthread_rwlock_t connections_lock = PTHREAD_RWLOCK_INITIALIZER;
+int max_connections;
+
+// Sockets that received output while this thread handled its current command
+__thread int dirty_sockets[DIRTY_LIMIT];
+__thread int dirty_count = 0;
+
+#ifdef HAVE_IO_URING
+__thread Uring *uring;       // Ring of the shard this thread runs
+__thread Shard *ring_shard;
+#endif
 
 /**PROTOTYPES*/
+void parse_options(int argc, char **argv);
+
+void raise_fd_limit();
+
+int open_listener(int port);
+
+void *run_shard(void *arg);
+
+void run_threads(Shard *shard);
+
+void run_epoll(Shard *shard);
+
+void accept_connections(Shard *shard);
+
+void schedule_connection(Connection *conn);
+
+void *epoll_worker(void *arg);
+
+ServeResult serve_connection(Connection *conn);
+
+void close_connection(Connection *conn);
+
+InputBuffer *input_buffer(Connection *conn);
+
+int input_recv(Connection *conn, int flags);
+
+bool input_append(Connection *conn, const char *data, int len);
+
+char *input_next_line(InputBuffer *in, char *scratch);
+
+char *input_next_frame(InputBuffer *in, char *scratch, int *type, int *len, bool *malformed);
+
+bool process_frame(Connection *conn, int type, char *payload, int len);
+
+void input_release(Connection *conn);
+
+bool process_input(Connection *conn);
+
+Connection *create_connection(Shard *shard, int socket);
+
+bool queue_output(Connection *conn, const char *data, int len, bool text);
+
+void append_output(Connection *conn, const char *data, int len);
+
+void consume_output(Connection *conn, size_t len);
+
+void discard_output(Connection *conn);
+
+void write_output(Connection *conn);
+
+void flush_connection(int socket);
+
+void flush_dirty_connections();
+
+bool uring_setup_shards();
+
+void run_uring(Shard *shard);
+
+#ifdef HAVE_IO_URING
+bool uring_init(Uring *ring);
+
+struct io_uring_sqe *uring_get_sqe();
+
+void uring_submit(unsigned wait);
+
+void uring_recycle_buffer(int bid);
+
+void uring_arm_accept(int sockfd);
+
+void uring_request_flush(Shard *owner, int socket);
+
+void uring_drain_flush_requests(Shard *shard);
+
+void uring_arm_recv(Connection *conn);
+
+void uring_submit_output(Connection *conn);
+
+void uring_handle_send(Connection *conn, int res);
+
+void uring_handle_recv(Connection *conn, int res, unsigned flags);
+
+void uring_close_connection(Connection *conn);
+
+void uring_release_connection(Connection *conn);
+
+void uring_accept(Shard *shard, int newsockfd);
+#endif
+
 void *handle_client(void *arg);
 
+Player *process_login_command(int client_socket, char *buffer);
+
+void process_command(Player *player, char *buffer);
+
+unsigned command_hash(unsigned seed, const char *token, size_t len);
+
+void build_command_table();
+
+CommandSpec *find_command(const char *token, size_t len);
+
+void set_private(Player *player);
+
+void set_public(Player *player);
+
 int send_message(int sockfd, const char *message);
 
-void send_board(int socket, Player *player1, Player *player2);
+int send_output(int sockfd, const char *data, int len, bool text);
+
+bool connection_is_binary(int sockfd);
+
+void set_connection_binary(int sockfd, bool binary);
+
+void frame_init(Frame *frame, MessageType type);
+
+bool frame_put_u8(Frame *frame, int value);
+
+bool frame_put_u16(Frame *frame, int value);
+
+bool frame_put_string(Frame *frame, const char *text);
+
+bool frame_put_text(Frame *frame, const char *text);
 
-void send_boards_players(Player *current, Player *opponent);
+int send_frame(int sockfd, Frame *frame);
+
+void send_error(int sockfd, const char *text);
+
+void send_chat(int sockfd, ChatChannel channel, const char *from, const char *text, const char *formatted);
+
+void send_board(int socket, Game *game, int side);
 
 void send_boards(Game *game);
 
 void notify_move(const char *player_pseudo, int pit_index, Game *game);
 
-int answer(int sockfd);
+void send_move_notice(int socket, const char *message, Frame *frame);
+
+void send_auth_status(int sockfd, AuthResult code, const char *text);
 
 Player *find_player_by_pseudo(const char *pseudo);
 
+Player *find_player(const char *pseudo, int len);
+
+Player *allocate_player();
+
+int registered_players();
+
+int select_top_players(Player **top, bool online_only);
+
+bool add_online_player(Player *player);
+
+void remove_online_player(Player *player);
+
+Player *player_at(int index);
+
+unsigned pseudo_hash(const char *pseudo, int len);
+
+void player_index_insert(Player *player);
+
+void tokenize_command(char *line, Command *cmd);
+
+Slice command_text(Command *cmd, int from);
+
+bool slice_equals(Slice slice, const char *text);
+
+bool slice_to_int(Slice slice, int *value);
+
 Player *handle_registration(char *pseudo, char *password, int client_socket);
 
 Player *handle_login(char *pseudo, char *password, int client_socket);
@@ -136,31 +790,83 @@ void update_access(Player *player, int private);
 
 void send_access(Player *player);
 
-void send_global_message(Player *player, char *buffer);
+void send_global_message(Player *player, Command *cmd);
 
-void send_game_message(Player *player, char *buffer);
+void send_game_message(Player *player, Command *cmd);
 
-void send_direct_message(Player *player, char *buffer);
+void send_direct_message(Player *player, Command *cmd);
 
-void update_observers(int game_id);
+void update_observers(Player *player);
 
-bool can_observe(Player *player, int game_id);
+bool can_observe(Player *player, Game *game);
 
 bool in_friend_list(Player *player, Player *target);
 
 void handle_see_bio(Player *player);
 
-void handle_update_bio(Player *player, char *command);
+void handle_update_bio(Player *player, Command *cmd);
 
-void handle_see_player_bio(Player *player_target, char *command);
+void handle_see_player_bio(Player *player_target, Command *cmd);
 
 void save_player_to_file(Player *player);
 
 void load_players_from_file();
 
+bool load_players_snapshot();
+
+PlayerProfile *lock_profile(Player *player);
+
+bool zeroed_mutex_is_unlocked();
+
+const SnapshotPlayer *snapshot_player(int record);
+
+void load_players_from_text();
+
+void convert_players_file();
+
+Player *restore_player(const char *pseudo, const char *password, int private);
+
+void replay_player_journal();
+
+bool apply_journal_record(char *record);
+
+void journal_player_change(const char *format, ...);
+
+unsigned long queue_player_change(const char *format, ...);
+
+unsigned long format_player_change(const char *format, va_list args);
+
+void persist_record(PersistTarget target, const char *data, int len);
+
+unsigned long queue_record(PersistTarget target, const char *data, int len);
+
+void wait_for_disk(unsigned long sequence);
+
+void start_persistence();
+
+void *run_persistence(void *arg);
+
+long write_persist_batch(PersistRecord *batch);
+
 void load_game_stats();
 
-void update_players_file();
+void credit_game_result(Player *player, int outcome);
+
+unsigned long record_game_result(Game *game, GameResult result);
+
+void count_archived_games(const GameRecord *records, size_t count);
+
+void *count_archived_games_thread(void *arg);
+
+void rebuild_game_results(int threads);
+
+void open_game_archive();
+
+void archive_game(const char *data, int len);
+
+void import_games_file();
+
+void compact_players_file();
 
 bool is_pseudo_taken(const char *pseudo);
 
@@ -174,13 +880,27 @@ void send_top_players(Player *player);
 
 void send_all_players(Player *player);
 
-void menu(Player *player);
+void send_server_stats(Player *player);
+
+void send_listing(Player *player, ListingKind kind);
+
+void invalidate_listings(unsigned kinds);
+
+Listing *collect_listing(ListingKind kind);
+
+void refresh_listing(ListingKind kind);
+
+void publish_listing(ListingKind kind, Listing *fresh);
+
+Listing *read_listing(ListingKind kind, int *epoch);
+
+void listing_read_end(int epoch);
 
 void send_friend_list(Player *player);
 
-void handle_add_friend(Player *player, char *command);
+void handle_add_friend(Player *player, Command *cmd);
 
-void handle_remove_friend(Player *player, char *command);
+void handle_remove_friend(Player *player, Command *cmd);
 
 /** GAME */
 void handle_save_game(Player *player);
@@ -191,33 +911,67 @@ void initialize_game(Player *player1, Player *player2);
 
 void send_game_start_message(int client_socket, int challenged_socket, int turn);
 
-int capture_seeds(Player *current_player, Player *opponent, int last_pit);
+void init_sowing_tables();
+
+int capture_seeds(GameState *state, int side, int last_pit);
+
+void notify_capture(Game *game, int side, int captured_seeds);
 
-int is_game_over(Player player1, Player player2);
+int is_game_over(const GameState *state);
 
-int dead(Player player);
+int dead(const uint8_t *pits);
 
-int is_savior(Player player);
+int is_savior(const uint8_t *pits);
 
-void add_move(Player *player, int pit_index, int seeds_before_move);
+void add_move(Game *game, Player *player, int pit_index, int seeds_before_move);
 
-int distribute_seeds(Player *current_player, Player *opponent, int pit_index);
+int distribute_seeds(GameState *state, int side, int pit_index);
 
 void handle_leave(Player *player);
 
 void end_game(Player *player1, Player *player2, int result, Game *game);
 
-int add_game(Game *new_game);
+GameHandle add_game(Game *new_game);
+
+Game *acquire_game(GameHandle handle);
+
+Game *acquire_player_game(Player *player);
+
+GameHandle find_game_against(Player *player, Slice opponent);
+
+Game *acquire_game_against(Player *player, Slice opponent);
 
-void remove_game(int game_id);
+int player_games(Player *player, GameHandle *handles);
+
+bool add_membership(Player *player, GameHandle handle);
+
+void remove_membership(Player *player, GameHandle handle);
+
+void release_game(Game *game);
+
+void finish_game(Game *game);
 
 void clean_up_game(Game *game);
 
-void clean_player_game_state(Player *player);
+void *pool_alloc(Pool *pool);
+
+void pool_free(Pool *pool, void *block);
+
+bool reserve_observer(Game *game);
+
+void free_game(Game *game);
+
+void make_move(Player *player, Command *cmd);
 
-void make_move(Player *player, char *command);
+void play_move(Player *player, int pit_index);
 
-void handle_observe(Player *player, char *command);
+void send_my_games(Player *player);
+
+bool switch_game(Player *player, Slice opponent);
+
+void handle_switch_game(Player *player, Command *cmd);
+
+void handle_observe(Player *player, Command *cmd);
 
 void handle_quit_observe(Player *player);
 
@@ -225,14 +979,16 @@ void add_observer(Player *observer, Player *to_observe);
 
 void remove_observer(Player *observer);
 
+bool detach_observer(Player *observer);
+
 /** CHALLENGE */
 void send_pending_challenge(Player *player);
 
-void handle_challenge(Player *player, char *command);
+void handle_challenge(Player *player, Command *cmd);
 
 void handle_revoke_challenge(Player *player);
 
-bool verify_not_self_challenge(Player *player, char *challenge_user);
+bool verify_not_self_challenge(Player *player, Slice challenge_user);
 
 bool is_valid_challenge(Player *player, Player *challenged);
 
@@ -250,43 +1006,309 @@ void clean_bio(char *bio);
 
 /**CODE*/
 
-int answer(int sockfd) {
-    usleep(300);
-    send_message(sockfd, "ANSWER\n");
-    usleep(300);
+// Single line reply to LOGIN/REGISTER, the client blocks until it arrives
+void send_auth_status(int sockfd, AuthResult code, const char *text) {
+    char status[BUFFER_SIZE];
+    int len = snprintf(status, sizeof(status), "AUTH %d %s\n", code, text);
+    // Stays a text line even when the client asked for frames
+    send_output(sockfd, status, len, false);
+}
+
+bool connection_is_binary(int sockfd) {
+    bool binary = false;
+    if (sockfd < 0 || sockfd >= max_connections) {
+        return false;
+    }
+    pthread_rwlock_rdlock(&connections_lock);
+    Connection *conn = connections[sockfd];
+    if (conn != NULL) {
+        pthread_mutex_lock(&conn->out_lock);
+        binary = conn->binary;
+        pthread_mutex_unlock(&conn->out_lock);
+    }
+    pthread_rwlock_unlock(&connections_lock);
+    return binary;
+}
+
+void set_connection_binary(int sockfd, bool binary) {
+    pthread_rwlock_rdlock(&connections_lock);
+    Connection *conn = connections[sockfd];
+    if (conn != NULL) {
+        pthread_mutex_lock(&conn->out_lock);
+        conn->binary = binary;
+        pthread_mutex_unlock(&conn->out_lock);
+    }
+    pthread_rwlock_unlock(&connections_lock);
+}
+
+void frame_init(Frame *frame, MessageType type) {
+    frame->data[2] = (unsigned char) type;
+    frame->len = FRAME_HEADER;
+}
+
+bool frame_put_u8(Frame *frame, int value) {
+    if (frame->len + 1 > FRAME_MAX + 2) {
+        return false;
+    }
+    frame->data[frame->len++] = (unsigned char) value;
+    return true;
+}
+
+bool frame_put_u16(Frame *frame, int value) {
+    if (frame->len + 2 > FRAME_MAX + 2) {
+        return false;
+    }
+    frame->data[frame->len++] = (unsigned char) (value >> 8);
+    frame->data[frame->len++] = (unsigned char) value;
+    return true;
+}
+
+// Length-prefixed string, false when the frame is full
+bool frame_put_string(Frame *frame, const char *text) {
+    size_t len = strlen(text);
+    if (len > 255 || frame->len + 1 + (int) len > FRAME_MAX + 2) {
+        return false;
+    }
+    frame->data[frame->len++] = (unsigned char) len;
+    memcpy(frame->data + frame->len, text, len);
+    frame->len += (int) len;
+    return true;
+}
+
+// Unprefixed text running to the end of the frame
+bool frame_put_text(Frame *frame, const char *text) {
+    size_t len = strlen(text);
+    if (frame->len + (int) len > FRAME_MAX + 2) {
+        len = FRAME_MAX + 2 - frame->len;
+    }
+    memcpy(frame->data + frame->len, text, len);
+    frame->len += (int) len;
+    return true;
+}
+
+int send_frame(int sockfd, Frame *frame) {
+    int size = frame->len - 2;
+    frame->data[0] = (unsigned char) (size >> 8);
+    frame->data[1] = (unsigned char) size;
+    return send_output(sockfd, (const char *) frame->data, frame->len, false);
+}
+
+void send_error(int sockfd, const char *text) {
+    if (!connection_is_binary(sockfd)) {
+        char line[BUFFER_SIZE];
+        snprintf(line, sizeof(line), "%s\n", text);
+        send_message(sockfd, line);
+        return;
+    }
+    Frame frame;
+    frame_init(&frame, MSG_ERROR);
+    frame_put_text(&frame, text);
+    send_frame(sockfd, &frame);
+}
+
+// Formatted is the text protocol rendering of the same message
+void send_chat(int sockfd, ChatChannel channel, const char *from, const char *text, const char *formatted) {
+    if (!connection_is_binary(sockfd)) {
+        send_message(sockfd, formatted);
+        return;
+    }
+    Frame frame;
+    frame_init(&frame, MSG_CHAT);
+    frame_put_u8(&frame, channel);
+    frame_put_string(&frame, from);
+    frame_put_text(&frame, text);
+    send_frame(sockfd, &frame);
 }
 
+// Queue a message for the client, it is written when the current command has been handled
 int send_message(int sockfd, const char *message) {
-    send(sockfd, message, strlen(message), 0);
+    return send_output(sockfd, message, (int) strlen(message), true);
 }
 
-int main(int argc, char **argv) {
-    int sockfd, newsockfd, clilen;
-    struct sockaddr_in cli_addr, serv_addr;
+// Text is wrapped in a MSG_TEXT frame for binary clients, anything else is queued as is
+int send_output(int sockfd, const char *data, int len, bool text) {
+    if (sockfd < 0 || sockfd >= max_connections) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&connections_lock);
+    Connection *conn = connections[sockfd];
+    bool newly_dirty = conn != NULL && queue_output(conn, data, len, text);
+    bool failed = conn == NULL || conn->out_failed;
+    pthread_rwlock_unlock(&connections_lock);
+
+    if (newly_dirty) {
+        if (dirty_count == DIRTY_LIMIT) {
+            flush_dirty_connections();
+        }
+        dirty_sockets[dirty_count++] = sockfd;
+    }
+    return failed ? -1 : len;
+}
 
-    if (argc != 2) {
-        printf("Usage: socket_server port\n");
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "--convert-players") == 0) {
+        convert_players_file();
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "--import-games") == 0) {
+        import_games_file();
+        return 0;
+    }
+    if ((argc == 2 || (argc == 3 && strncmp(argv[2], "--threads=", 10) == 0)) &&
+        strcmp(argv[1], "--rebuild-results") == 0) {
+        rebuild_game_results(argc == 3 ? atoi(argv[2] + 10) : (int) sysconf(_SC_NPROCESSORS_ONLN));
+        return 0;
+    }
+    if (argc < 2) {
+        printf("Usage: socket_server port [--io-model=threads|epoll|uring] [--workers=N] [--shards=N|auto]\n"
+               "                          [--durability=none|batched|every-write] [--flush-interval=MS]\n"
+               "                          [--flush-batch=N]\n"
+               "       socket_server --convert-players\n"
+               "       socket_server --import-games\n"
+               "       socket_server --rebuild-results [--threads=N]\n");
         exit(0);
     }
+    parse_options(argc, argv);
 
     printf("Server starting...\n");
+    init_sowing_tables();
+
+    /* A client vanishing mid-send must not take the whole server down */
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+    connections = calloc(max_connections, sizeof(Connection *));
+    shards = calloc(shard_count, sizeof(Shard));
+    if (connections == NULL || shards == NULL) {
+        perror("Connection table allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* One listener per shard, the kernel spreads incoming connections across them */
+    for (int i = 0; i < shard_count; i++) {
+        Shard *shard = &shards[i];
+        shard->id = i;
+        shard->epoll_fd = -1;
+        shard->listen_fd = open_listener(atoi(argv[1]));
+        // Workers are split evenly, every shard gets at least one
+        shard->workers = worker_count / shard_count + (i < worker_count % shard_count);
+        if (shard->workers == 0) {
+            shard->workers = 1;
+        }
+        pthread_mutex_init(&shard->work_mutex, NULL);
+        pthread_cond_init(&shard->work_cond, NULL);
+#ifdef HAVE_IO_URING
+        pthread_mutex_init(&shard->flush_mutex, NULL);
+#endif
+    }
+
+    load_players_from_file();
+    load_game_stats();
+    start_persistence();
+    build_command_table();
+
+    printf("Server listening on port %s...\n", argv[1]);
+    if (shard_count > 1) {
+        printf("Accepting on %d shards\n", shard_count);
+    }
+
+    if (io_model == IO_MODEL_URING && !uring_setup_shards()) {
+        io_model = IO_MODEL_EPOLL;
+    }
+
+    for (int i = 1; i < shard_count; i++) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, run_shard, &shards[i]) != 0) {
+            perror("Shard creation failed");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread_id);
+    }
+    run_shard(&shards[0]);
+
+    return 0;
+}
+
+void parse_options(int argc, char **argv) {
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--io-model=threads") == 0) {
+            io_model = IO_MODEL_THREADS;
+        } else if (strcmp(argv[i], "--io-model=epoll") == 0) {
+            io_model = IO_MODEL_EPOLL;
+        } else if (strcmp(argv[i], "--io-model=uring") == 0) {
+            io_model = IO_MODEL_URING;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0) {
+            worker_count = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--shards=auto") == 0) {
+            shard_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            if (shard_count < 1) {
+                shard_count = 1;
+            }
+        } else if (strncmp(argv[i], "--shards=", 9) == 0 && atoi(argv[i] + 9) > 0) {
+            shard_count = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "--durability=none") == 0) {
+            durability = DURABILITY_NONE;
+        } else if (strcmp(argv[i], "--durability=batched") == 0) {
+            durability = DURABILITY_BATCHED;
+        } else if (strcmp(argv[i], "--durability=every-write") == 0) {
+            durability = DURABILITY_EVERY_WRITE;
+        } else if (strncmp(argv[i], "--flush-interval=", 17) == 0 && atoi(argv[i] + 17) > 0) {
+            flush_interval_ms = atoi(argv[i] + 17);
+        } else if (strncmp(argv[i], "--flush-batch=", 14) == 0 && atoi(argv[i] + 14) > 0) {
+            flush_batch = atoi(argv[i] + 14);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            printf("Usage: socket_server port [--io-model=threads|epoll|uring] [--workers=N] [--shards=N|auto]\n"
+               "                          [--durability=none|batched|every-write] [--flush-interval=MS]\n"
+               "                          [--flush-batch=N]\n"
+               "       socket_server --convert-players\n"
+               "       socket_server --import-games\n"
+               "       socket_server --rebuild-results [--threads=N]\n");
+            exit(0);
+        }
+    }
+}
+
+// Allow as many open sockets as the hard limit permits, the reactor is sized from it
+void raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > MAX_CONNECTIONS) {
+            limit.rlim_cur = MAX_CONNECTIONS;
+        }
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+        max_connections = (int) limit.rlim_cur;
+    } else {
+        max_connections = 1024;
+    }
+}
+
+int open_listener(int port) {
+    struct sockaddr_in serv_addr;
 
     /* Open the socket */
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         perror("Socket creation failed");
         exit(EXIT_FAILURE);
     }
 
-
-    load_players_from_file();
-    load_game_stats();
+    // Only opt in when sharding, otherwise a second server on the same port must still fail to bind
+    if (shard_count > 1) {
+        int one = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("SO_REUSEPORT failed");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     /* Initialize parameters */
     bzero((char *) &serv_addr, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(atoi(argv[1]));
+    serv_addr.sin_port = htons(port);
 
     /* Perform the bind */
     if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
@@ -296,173 +1318,1430 @@ int main(int argc, char **argv) {
     }
 
     /* Initialize listening */
-    listen(sockfd, MAX_ONLINE_PLAYERS);
+    listen(sockfd, SOMAXCONN);
+    return sockfd;
+}
 
-    printf("Server listening on port %s...\n", argv[1]);
+void *run_shard(void *arg) {
+    Shard *shard = arg;
+
+    if (io_model == IO_MODEL_URING) {
+        run_uring(shard);
+    } else if (io_model == IO_MODEL_EPOLL) {
+        run_epoll(shard);
+    } else {
+        run_threads(shard);
+    }
+    close(shard->listen_fd);
+    return NULL;
+}
+
+void run_threads(Shard *shard) {
+    int newsockfd;
+    socklen_t clilen;
+    struct sockaddr_in cli_addr;
+
+    while (1) {
+        /* Accept a client connection */
+        clilen = sizeof(cli_addr);
+        newsockfd = accept(shard->listen_fd, (struct sockaddr *) &cli_addr, &clilen);
+        if (newsockfd < 0) {
+            printf("Accept failed\n");
+            continue; // Continue to accept other clients
+        }
+
+        if (newsockfd >= max_connections) {
+            printf("Too many connections, rejecting client\n");
+            close(newsockfd);
+            continue;
+        }
+
+        printf("Connection accepted from %s:%d\n",
+               inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
+
+        /* Create a new thread for each client */
+        Connection *conn = create_connection(shard, newsockfd);
+        if (conn == NULL) {
+            continue;
+        }
+
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, handle_client, conn) != 0) {
+            perror("Thread creation failed");
+            close_connection(conn);
+        } else {
+            pthread_detach(thread_id); // Detach the thread, so it cleans up automatically
+        }
+    }
+}
+
+void run_epoll(Shard *shard) {
+    struct epoll_event event, events[MAX_EPOLL_EVENTS];
+    int sockfd = shard->listen_fd;
+
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epoll_fd < 0) {
+        perror("Reactor initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // The listener stays level-triggered, accept_connections drains it until EAGAIN anyway
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    event.events = EPOLLIN;
+    event.data.fd = sockfd;
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+        perror("Failed to register listening socket");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < shard->workers; i++) {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, epoll_worker, shard) != 0) {
+            perror("Worker creation failed");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread_id);
+    }
+    if (shard->id == 0) {
+        printf("Reactor running with %d workers, up to %d connections\n", worker_count, max_connections);
+    }
+
+    while (1) {
+        int n = epoll_wait(shard->epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait failed");
+            }
+            continue;
+        }
+
+        pthread_rwlock_rdlock(&connections_lock);
+        pthread_mutex_lock(&shard->work_mutex);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == sockfd) {
+                continue;
+            }
+            // Look the descriptor up rather than trusting a pointer, the connection may already be gone
+            Connection *conn = connections[events[i].data.fd];
+            if (conn != NULL) {
+                schedule_connection(conn);
+            }
+        }
+        pthread_mutex_unlock(&shard->work_mutex);
+        pthread_rwlock_unlock(&connections_lock);
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == sockfd) {
+                accept_connections(shard);
+            }
+        }
+    }
+}
+
+void accept_connections(Shard *shard) {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen;
+
+    while (1) {
+        clilen = sizeof(cli_addr);
+        int newsockfd = accept4(shard->listen_fd, (struct sockaddr *) &cli_addr, &clilen, SOCK_CLOEXEC);
+        if (newsockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        if (newsockfd >= max_connections) {
+            printf("Too many connections, rejecting client\n");
+            close(newsockfd);
+            continue;
+        }
+
+        printf("Connection accepted from %s:%d\n",
+               inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
+
+        Connection *conn = create_connection(shard, newsockfd);
+        if (conn == NULL) {
+            continue;
+        }
+
+        // Input that raced the registration is still reported, edge-triggered add starts "ready".
+        // EPOLLOUT edges hand output left over after EAGAIN back to a worker.
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = newsockfd;
+        if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, newsockfd, &event) < 0) {
+            perror("Failed to register client socket");
+            close_connection(conn);
+        }
+    }
+}
+
+// Caller holds the shard's work_mutex
+void schedule_connection(Connection *conn) {
+    Shard *shard = conn->shard;
+    if (conn->state == CONN_RUNNING) {
+        conn->state = CONN_RERUN;
+        return;
+    }
+    if (conn->state != CONN_IDLE) {
+        return;
+    }
+
+    conn->state = CONN_QUEUED;
+    conn->next = NULL;
+    if (shard->work_tail != NULL) {
+        shard->work_tail->next = conn;
+    } else {
+        shard->work_head = conn;
+    }
+    shard->work_tail = conn;
+    pthread_cond_signal(&shard->work_cond);
+}
+
+void *epoll_worker(void *arg) {
+    Shard *shard = arg;
+
+    while (1) {
+        pthread_mutex_lock(&shard->work_mutex);
+        while (shard->work_head == NULL) {
+            pthread_cond_wait(&shard->work_cond, &shard->work_mutex);
+        }
+        Connection *conn = shard->work_head;
+        shard->work_head = conn->next;
+        if (shard->work_head == NULL) {
+            shard->work_tail = NULL;
+        }
+        conn->state = CONN_RUNNING;
+        pthread_mutex_unlock(&shard->work_mutex);
+
+        ServeResult result = serve_connection(conn);
+        if (result == SERVE_CLOSED) {
+            continue;
+        }
+
+        // Go idle only if nothing arrived meanwhile, otherwise requeue behind the others
+        pthread_mutex_lock(&shard->work_mutex);
+        if (result == SERVE_BUDGET || conn->state == CONN_RERUN) {
+            conn->state = CONN_IDLE;
+            schedule_connection(conn);
+        } else {
+            conn->state = CONN_IDLE;
+        }
+        pthread_mutex_unlock(&shard->work_mutex);
+    }
+}
+
+ServeResult serve_connection(Connection *conn) {
+    // Woken by EPOLLOUT, or output queued by other threads hit EAGAIN earlier
+    pthread_mutex_lock(&conn->out_lock);
+    write_output(conn);
+    pthread_mutex_unlock(&conn->out_lock);
+
+    for (int reads = 0; reads < READ_BUDGET; reads++) {
+        int n = input_recv(conn, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            input_release(conn);
+            return SERVE_DRAINED;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                printf("Client disconnected\n");
+            } else {
+                printf("Error reading from client\n");
+            }
+            if (conn->player != NULL && conn->player->socket == conn->socket) {
+                handle_logout(conn->player);
+            }
+            flush_dirty_connections();
+            close_connection(conn);
+            return SERVE_CLOSED;
+        }
+
+        bool open = process_input(conn);
+        flush_dirty_connections();
+        if (!open) {
+            close_connection(conn);
+            return SERVE_CLOSED;
+        }
+    }
+    return SERVE_BUDGET;
+}
+
+Connection *create_connection(Shard *shard, int socket) {
+    Connection *conn = calloc(1, sizeof(Connection));
+    if (conn == NULL) {
+        perror("Failed to allocate connection");
+        close(socket);
+        return NULL;
+    }
+    conn->socket = socket;
+    conn->shard = shard;
+    __atomic_add_fetch(&shard->connection_count, 1, __ATOMIC_RELAXED);
+    conn->state = CONN_IDLE;
+    pthread_mutex_init(&conn->out_lock, NULL);
+
+    // Replies are already batched per command, do not let Nagle hold them back
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_rwlock_wrlock(&connections_lock);
+    connections[socket] = conn;
+    pthread_rwlock_unlock(&connections_lock);
+    return conn;
+}
+
+// Called by the thread that owns the connection
+void close_connection(Connection *conn) {
+    // Once unlisted no other thread can reach it, senders hold connections_lock while they use it
+    pthread_rwlock_wrlock(&connections_lock);
+    connections[conn->socket] = NULL;
+    pthread_rwlock_unlock(&connections_lock);
+
+    if (conn->shard->epoll_fd >= 0) {
+        epoll_ctl(conn->shard->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    }
+    __atomic_sub_fetch(&conn->shard->connection_count, 1, __ATOMIC_RELAXED);
+    close(conn->socket);
+    discard_output(conn);
+    pthread_mutex_destroy(&conn->out_lock);
+    free(conn->input);
+    free(conn);
+}
+
+// Append to the connection's queue, true if the socket still has to be listed for flushing
+bool queue_output(Connection *conn, const char *data, int len, bool text) {
+    bool newly_dirty = false;
+
+    pthread_mutex_lock(&conn->out_lock);
+    if (conn->out_failed) {
+        pthread_mutex_unlock(&conn->out_lock);
+        return false;
+    }
+    if (conn->out_bytes + len + FRAME_HEADER > OUTPUT_QUEUE_LIMIT) {
+        // The client stopped reading, drop it rather than buffering without bound
+        printf("Output queue limit reached, disconnecting client\n");
+        conn->out_failed = true;
+        discard_output(conn);
+        shutdown(conn->socket, SHUT_RDWR);
+        pthread_mutex_unlock(&conn->out_lock);
+        return false;
+    }
+
+    if (text && conn->binary) {
+        if (len > FRAME_MAX - 1) {
+            len = FRAME_MAX - 1;
+        }
+        char header[FRAME_HEADER] = {(char) ((len + 1) >> 8), (char) (len + 1), MSG_TEXT};
+        append_output(conn, header, FRAME_HEADER);
+    }
+    append_output(conn, data, len);
+
+    if (!conn->flush_pending) {
+        conn->flush_pending = true;
+        newly_dirty = true;
+    }
+    pthread_mutex_unlock(&conn->out_lock);
+    return newly_dirty;
+}
+
+// Copy into the tail chunks, caller holds out_lock
+void append_output(Connection *conn, const char *data, int len) {
+    while (len > 0) {
+        OutputChunk *chunk = conn->out_tail;
+        if (chunk == NULL || chunk->end == OUTPUT_CHUNK_SIZE) {
+            chunk = malloc(sizeof(OutputChunk));
+            if (chunk == NULL) {
+                perror("Failed to allocate output chunk");
+                break;
+            }
+            chunk->next = NULL;
+            chunk->start = chunk->end = 0;
+            if (conn->out_tail != NULL) {
+                conn->out_tail->next = chunk;
+            } else {
+                conn->out_head = chunk;
+            }
+            conn->out_tail = chunk;
+        }
+
+        int room = OUTPUT_CHUNK_SIZE - (int) chunk->end;
+        int part = len < room ? len : room;
+        memcpy(chunk->data + chunk->end, data, part);
+        chunk->end += part;
+        conn->out_bytes += part;
+        data += part;
+        len -= part;
+    }
+}
+
+// Drop bytes the kernel has accepted, caller holds out_lock
+void consume_output(Connection *conn, size_t len) {
+    conn->out_bytes -= len;
+    while (len > 0 && conn->out_head != NULL) {
+        OutputChunk *chunk = conn->out_head;
+        size_t available = chunk->end - chunk->start;
+        if (len < available) {
+            chunk->start += len;
+            return;
+        }
+        len -= available;
+        conn->out_head = chunk->next;
+        free(chunk);
+    }
+    if (conn->out_head == NULL) {
+        conn->out_tail = NULL;
+    }
+}
+
+void discard_output(Connection *conn) {
+    while (conn->out_head != NULL) {
+        OutputChunk *chunk = conn->out_head;
+        conn->out_head = chunk->next;
+        free(chunk);
+    }
+    conn->out_tail = NULL;
+    conn->out_bytes = 0;
+}
+
+// Gather the queue into writev batches until it drains or the socket would block, caller holds out_lock
+void write_output(Connection *conn) {
+    // Only the thread-per-client model may block here, reactors resume on EPOLLOUT
+    int flags = MSG_NOSIGNAL | (io_model == IO_MODEL_THREADS ? 0 : MSG_DONTWAIT);
+
+    while (conn->out_head != NULL) {
+        struct iovec iov[OUTPUT_MAX_IOV];
+        struct msghdr msg;
+        int count = 0;
+        for (OutputChunk *chunk = conn->out_head; chunk != NULL && count < OUTPUT_MAX_IOV; chunk = chunk->next) {
+            iov[count].iov_base = chunk->data + chunk->start;
+            iov[count].iov_len = chunk->end - chunk->start;
+            count++;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        ssize_t n = sendmsg(conn->socket, &msg, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                conn->out_failed = true;
+                discard_output(conn);
+            }
+            return;
+        }
+        consume_output(conn, (size_t) n);
+    }
+}
+
+void flush_connection(int socket) {
+    pthread_rwlock_rdlock(&connections_lock);
+    Connection *conn = connections[socket];
+    if (conn != NULL) {
+        pthread_mutex_lock(&conn->out_lock);
+        conn->flush_pending = false;
+#ifdef HAVE_IO_URING
+        if (io_model == IO_MODEL_URING && conn->shard != ring_shard) {
+            // Only the owning ring may submit for it, completions must come back there
+            uring_request_flush(conn->shard, socket);
+        } else if (io_model == IO_MODEL_URING) {
+            uring_submit_output(conn);
+        } else {
+            write_output(conn);
+        }
+#else
+        write_output(conn);
+#endif
+        pthread_mutex_unlock(&conn->out_lock);
+    }
+    pthread_rwlock_unlock(&connections_lock);
+}
+
+// Write out everything the current command produced, one writev per touched client
+void flush_dirty_connections() {
+    for (int i = 0; i < dirty_count; i++) {
+        flush_connection(dirty_sockets[i]);
+    }
+    dirty_count = 0;
+}
+
+InputBuffer *input_buffer(Connection *conn) {
+    if (conn->input == NULL) {
+        conn->input = calloc(1, sizeof(InputBuffer));
+        if (conn->input == NULL) {
+            perror("Failed to allocate input buffer");
+            exit(1);
+        }
+    }
+    return conn->input;
+}
+
+// Receive straight into the free part of the ring, wrapping with a second iovec
+int input_recv(Connection *conn, int flags) {
+    InputBuffer *in = input_buffer(conn);
+    unsigned free_space = INPUT_BUFFER_SIZE - (in->tail - in->head);
+    unsigned start = in->tail & (INPUT_BUFFER_SIZE - 1);
+    unsigned first = INPUT_BUFFER_SIZE - start < free_space ? INPUT_BUFFER_SIZE - start : free_space;
+
+    struct iovec iov[2];
+    iov[0].iov_base = in->data + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = in->data;
+    iov[1].iov_len = free_space - first;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = free_space > first ? 2 : 1;
+
+    int n = (int) recvmsg(conn->socket, &msg, flags);
+    if (n > 0) {
+        in->tail += n;
+    }
+    return n;
+}
+
+// Copies a completed read into the ring, false if it does not fit and the connection has to go
+bool input_append(Connection *conn, const char *data, int len) {
+    InputBuffer *in = input_buffer(conn);
+    if ((unsigned) len > INPUT_BUFFER_SIZE - (in->tail - in->head)) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        in->data[in->tail++ & (INPUT_BUFFER_SIZE - 1)] = data[i];
+    }
+    return true;
+}
+
+// Next complete command, terminated in place, or NULL while only a partial line is buffered
+char *input_next_line(InputBuffer *in, char *scratch) {
+    while (1) {
+        unsigned used = in->tail - in->head;
+        unsigned newline = in->head + in->scanned;
+        while (newline != in->tail && in->data[newline & (INPUT_BUFFER_SIZE - 1)] != '\n') {
+            newline++;
+        }
+
+        if (newline == in->tail) {
+            in->scanned = used;
+            // Never let one line fill the ring, it could no longer be framed
+            if (used >= BUFFER_SIZE - 1) {
+                if (!in->discarding) {
+                    printf("Command too long, discarding\n");
+                }
+                in->discarding = true;
+                in->head = in->tail;
+                in->scanned = 0;
+            }
+            return NULL;
+        }
+
+        unsigned start = in->head;
+        unsigned len = newline - start;
+        in->head = newline + 1;
+        in->scanned = 0;
+        if (in->discarding) {
+            in->discarding = false;
+            continue;
+        }
+        if (len >= BUFFER_SIZE - 1) {
+            printf("Command too long, discarding\n");
+            continue;
+        }
+
+        char *line;
+        if ((start & (INPUT_BUFFER_SIZE - 1)) + len < INPUT_BUFFER_SIZE) {
+            line = in->data + (start & (INPUT_BUFFER_SIZE - 1));
+        } else {
+            // The line wraps around the end of the ring, reassemble it
+            for (unsigned i = 0; i < len; i++) {
+                scratch[i] = in->data[(start + i) & (INPUT_BUFFER_SIZE - 1)];
+            }
+            line = scratch;
+        }
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        line[len] = '\0';
+        return line;
+    }
+}
+
+// Idle connections keep no input buffer around
+void input_release(Connection *conn) {
+    if (conn->input != NULL && conn->input->head == conn->input->tail && !conn->input->discarding) {
+        free(conn->input);
+        conn->input = NULL;
+    }
+}
+
+// Dispatch every complete command buffered on the connection, false once the session has ended
+bool process_input(Connection *conn) {
+    char scratch[BUFFER_SIZE + 1];
+    char *line;
+
+    while (!conn->binary || conn->player == NULL) {
+        if ((line = input_next_line(input_buffer(conn), scratch)) == NULL) {
+            return true;
+        }
+        if (conn->player == NULL) {
+            conn->player = process_login_command(conn->socket, line);
+            continue;
+        }
+
+        process_command(conn->player, line);
+        // LOGOUT detaches the player from this socket
+        if (conn->player->socket != conn->socket) {
+            return false;
+        }
+    }
+
+    // Binary clients switch to frames once logged in
+    int type, len;
+    bool malformed = false;
+    char *payload;
+    while ((payload = input_next_frame(input_buffer(conn), scratch, &type, &len, &malformed)) != NULL) {
+        if (!process_frame(conn, type, payload, len)) {
+            return false;
+        }
+    }
+    if (malformed) {
+        printf("Malformed frame, disconnecting client\n");
+        handle_logout(conn->player);
+        return false;
+    }
+    return true;
+}
+
+// Next complete frame, payload copied out and NUL terminated, NULL while only part of it is buffered
+char *input_next_frame(InputBuffer *in, char *scratch, int *type, int *len, bool *malformed) {
+    unsigned used = in->tail - in->head;
+    if (used < FRAME_HEADER) {
+        return NULL;
+    }
+
+    unsigned char b0 = in->data[in->head & (INPUT_BUFFER_SIZE - 1)];
+    unsigned char b1 = in->data[(in->head + 1) & (INPUT_BUFFER_SIZE - 1)];
+    unsigned size = (unsigned) b0 << 8 | b1;
+    if (size == 0 || size > BUFFER_SIZE) {
+        // The stream cannot be resynchronised
+        *malformed = true;
+        return NULL;
+    }
+    if (used < 2 + size) {
+        return NULL;
+    }
+
+    *type = (unsigned char) in->data[(in->head + 2) & (INPUT_BUFFER_SIZE - 1)];
+    *len = (int) size - 1;
+    for (int i = 0; i < *len; i++) {
+        scratch[i] = in->data[(in->head + FRAME_HEADER + i) & (INPUT_BUFFER_SIZE - 1)];
+    }
+    scratch[*len] = '\0';
+    in->head += 2 + size;
+    return scratch;
+}
+
+bool process_frame(Connection *conn, int type, char *payload, int len) {
+    switch (type) {
+        case MSG_COMMAND:
+            process_command(conn->player, payload);
+            break;
+        case MSG_MOVE:
+            if (len != 1) {
+                send_error(conn->socket, "Invalid move frame");
+                break;
+            }
+            play_move(conn->player, (unsigned char) payload[0]);
+            break;
+        default:
+            send_error(conn->socket, "Unsupported message type");
+            break;
+    }
+    // LOGOUT detaches the player from this socket
+    return conn->player->socket == conn->socket;
+}
+
+#ifdef HAVE_IO_URING
+// Rings are created up front so a kernel without io_uring falls back before any shard starts
+bool uring_setup_shards() {
+    for (int i = 0; i < shard_count; i++) {
+        if (!uring_init(&shards[i].uring)) {
+            printf("io_uring unavailable, falling back to epoll\n");
+            return false;
+        }
+    }
+    printf("io_uring backend running, up to %d connections\n", max_connections);
+    return true;
+}
+
+// Map the rings of a fresh io_uring instance and register the provided recv buffers
+bool uring_init(Uring *ring) {
+    uring = ring;
+
+    struct utsname host;
+    int major = 0, minor = 0;
+    if (uname(&host) == 0) {
+        sscanf(host.release, "%d.%d", &major, &minor);
+    }
+    if (major < 6) {
+        printf("Kernel %s lacks multishot recv\n", host.release);
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * 4;
+    uring->fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring->fd < 0) {
+        perror("io_uring_setup failed");
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+
+    char *sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         uring->fd, IORING_OFF_SQ_RING);
+    char *cq_ring = sq_ring;
+    if (sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->fd, IORING_OFF_CQ_RING);
+    }
+    uring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || uring->sqes == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        close(uring->fd);
+        return false;
+    }
+
+    uring->sq_head = (unsigned *) (sq_ring + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (sq_ring + params.sq_off.tail);
+    uring->sq_mask = *(unsigned *) (sq_ring + params.sq_off.ring_mask);
+    uring->sq_entries = params.sq_entries;
+    uring->cq_head = (unsigned *) (cq_ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (cq_ring + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *) (cq_ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes);
+    uring->sqe_tail = uring->submitted = *uring->sq_tail;
+
+    // SQE slots are used in ring order, so the indirection array is the identity
+    unsigned *sq_array = (unsigned *) (sq_ring + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    size_t ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    uring->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring->buffers = malloc((size_t) URING_BUFFERS * BUFFER_SIZE);
+    if (uring->buf_ring == MAP_FAILED || uring->buffers == NULL) {
+        perror("Failed to allocate recv buffers");
+        close(uring->fd);
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) uring->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("Provided buffer ring registration failed");
+        close(uring->fd);
+        return false;
+    }
+
+    uring->buf_tail = 0;
+    for (int bid = 0; bid < URING_BUFFERS; bid++) {
+        uring_recycle_buffer(bid);
+    }
+    return true;
+}
+
+struct io_uring_sqe *uring_get_sqe() {
+    if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+        // Ring full, hand what we have to the kernel to make room
+        uring_submit(0);
+        if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &uring->sqes[uring->sqe_tail & uring->sq_mask];
+    uring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Publish queued SQEs with a single io_uring_enter, optionally waiting for completions
+void uring_submit(unsigned wait) {
+    __atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = uring->sqe_tail - uring->submitted;
+
+    while (1) {
+        int ret = (int) syscall(__NR_io_uring_enter, uring->fd, to_submit, wait,
+                                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) {
+            uring->submitted += ret;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter failed");
+            return;
+        }
+        if (errno != EINTR) {
+            return;  // Completion queue backed up, the caller reaps and retries
+        }
+    }
+}
+
+void uring_recycle_buffer(int bid) {
+    struct io_uring_buf *buf = &uring->buf_ring->bufs[uring->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (unsigned long) (uring->buffers + (size_t) bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    uring->buf_tail++;
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_arm_accept(int sockfd) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_ACCEPT;
+}
+
+// Queue a socket for the ring that owns it and wake that ring with a MSG_RING completion
+void uring_request_flush(Shard *owner, int socket) {
+    pthread_mutex_lock(&owner->flush_mutex);
+    if (owner->flush_count == owner->flush_capacity) {
+        int capacity = owner->flush_capacity ? owner->flush_capacity * 2 : 64;
+        int *grown = realloc(owner->flush_sockets, capacity * sizeof(int));
+        if (grown == NULL) {
+            perror("Failed to queue flush request");
+            pthread_mutex_unlock(&owner->flush_mutex);
+            return;
+        }
+        owner->flush_sockets = grown;
+        owner->flush_capacity = capacity;
+    }
+    owner->flush_sockets[owner->flush_count++] = socket;
+    bool wake = !owner->wake_pending;
+    owner->wake_pending = true;
+    pthread_mutex_unlock(&owner->flush_mutex);
+
+    if (wake) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        if (sqe == NULL) {
+            return;
+        }
+        sqe->opcode = IORING_OP_MSG_RING;
+        sqe->fd = owner->uring.fd;
+        sqe->off = URING_WAKE;        // user_data of the completion posted on the owner's ring
+        sqe->user_data = URING_IGNORE;
+    }
+}
+
+void uring_drain_flush_requests(Shard *shard) {
+    pthread_mutex_lock(&shard->flush_mutex);
+    int count = shard->flush_count;
+    int *sockets = shard->flush_sockets;
+    shard->flush_sockets = NULL;
+    shard->flush_count = shard->flush_capacity = 0;
+    shard->wake_pending = false;
+    pthread_mutex_unlock(&shard->flush_mutex);
+
+    for (int i = 0; i < count; i++) {
+        flush_connection(sockets[i]);
+    }
+    free(sockets);
+}
+
+void uring_arm_recv(Connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uintptr_t) conn | URING_RECV;
+    conn->recv_armed = true;
+}
+
+// Hand the whole queue to the kernel as one SENDMSG, caller holds out_lock
+void uring_submit_output(Connection *conn) {
+    if (conn->send_in_flight || conn->out_head == NULL) {
+        return;
+    }
+
+    int count = 0;
+    for (OutputChunk *chunk = conn->out_head; chunk != NULL && count < OUTPUT_MAX_IOV; chunk = chunk->next) {
+        conn->send_iov[count].iov_base = chunk->data + chunk->start;
+        conn->send_iov[count].iov_len = chunk->end - chunk->start;
+        count++;
+    }
+    memset(&conn->send_msg, 0, sizeof(conn->send_msg));
+    conn->send_msg.msg_iov = conn->send_iov;
+    conn->send_msg.msg_iovlen = count;
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->socket;
+    sqe->addr = (unsigned long) &conn->send_msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t) conn | URING_SEND;
+    conn->send_in_flight = true;
+}
+
+void uring_handle_send(Connection *conn, int res) {
+    pthread_mutex_lock(&conn->out_lock);
+    conn->send_in_flight = false;
+    if (res > 0) {
+        // Short sends leave the rest queued, it goes out with whatever was added meanwhile
+        consume_output(conn, (size_t) res);
+    } else if (res != -EAGAIN && res != -EINTR) {
+        conn->out_failed = true;
+        discard_output(conn);
+    }
+    uring_submit_output(conn);
+    pthread_mutex_unlock(&conn->out_lock);
+
+    uring_release_connection(conn);
+}
+
+void uring_handle_recv(Connection *conn, int res, unsigned flags) {
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        int bid = (int) (flags >> IORING_CQE_BUFFER_SHIFT);
+        char *buffer = uring->buffers + (size_t) bid * BUFFER_SIZE;
+        bool appended = !conn->closing && input_append(conn, buffer, res);
+        uring_recycle_buffer(bid);
+        if (!conn->closing && !appended) {
+            printf("Input buffer overflow, disconnecting client\n");
+            if (conn->player != NULL && conn->player->socket == conn->socket) {
+                handle_logout(conn->player);
+            }
+            uring_close_connection(conn);
+        } else if (!conn->closing && !process_input(conn)) {
+            uring_close_connection(conn);
+        }
+        // Queue the replies now so a long completion batch does not pile up output
+        flush_dirty_connections();
+        input_release(conn);
+    }
+    if (flags & IORING_CQE_F_MORE) {
+        return;
+    }
+
+    conn->recv_armed = false;
+    if (!conn->closing && (res > 0 || res == -ENOBUFS)) {
+        uring_arm_recv(conn);
+        return;
+    }
+
+    if (!conn->closing) {
+        if (res == 0) {
+            printf("Client disconnected\n");
+        } else {
+            printf("Error reading from client\n");
+        }
+        if (conn->player != NULL && conn->player->socket == conn->socket) {
+            handle_logout(conn->player);
+        }
+        conn->closing = true;
+    }
+    uring_release_connection(conn);
+}
+
+// Stop reading, the descriptor is closed once queued replies have gone out
+void uring_close_connection(Connection *conn) {
+    conn->closing = true;
+    if (!conn->recv_armed) {
+        uring_release_connection(conn);
+        return;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uintptr_t) conn | URING_RECV;
+        sqe->user_data = URING_IGNORE;
+    }
+}
+
+void uring_release_connection(Connection *conn) {
+    if (!conn->closing || conn->recv_armed || conn->send_in_flight || conn->out_head != NULL) {
+        return;
+    }
+    close_connection(conn);
+}
+
+void uring_accept(Shard *shard, int newsockfd) {
+    if (newsockfd >= max_connections) {
+        printf("Too many connections, rejecting client\n");
+        close(newsockfd);
+        return;
+    }
+
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(cli_addr);
+    if (getpeername(newsockfd, (struct sockaddr *) &cli_addr, &clilen) == 0) {
+        printf("Connection accepted from %s:%d\n",
+               inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
+    }
+
+    Connection *conn = create_connection(shard, newsockfd);
+    if (conn != NULL) {
+        uring_arm_recv(conn);
+    }
+}
+
+void run_uring(Shard *shard) {
+    int sockfd = shard->listen_fd;
+    uring = &shard->uring;
+    ring_shard = shard;
+
+    uring_arm_accept(sockfd);
+    while (1) {
+        // Everything produced by the previous batch goes to the kernel in one io_uring_enter
+        uring_drain_flush_requests(shard);
+        flush_dirty_connections();
+        uring_submit(1);
+
+        unsigned head = *uring->cq_head;
+        while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+            void *target = (void *) (uintptr_t) (user_data & ~URING_TAG_MASK);
+            switch (user_data & URING_TAG_MASK) {
+                case URING_ACCEPT:
+                    if (res >= 0) {
+                        uring_accept(shard, res);
+                    } else {
+                        fprintf(stderr, "Accept failed: %s\n", strerror(-res));
+                    }
+                    if (!(flags & IORING_CQE_F_MORE)) {
+                        uring_arm_accept(sockfd);
+                    }
+                    break;
+                case URING_RECV:
+                    uring_handle_recv(target, res, flags);
+                    break;
+                case URING_SEND:
+                    uring_handle_send(target, res);
+                    break;
+                case URING_WAKE:
+                    // Requests are drained before the next submit
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+#else
+bool uring_setup_shards() {
+    printf("Built without io_uring support, falling back to epoll\n");
+    return false;
+}
+
+void run_uring(Shard *shard) {
+    run_epoll(shard);
+}
+#endif
+
+void *handle_client(void *arg) {
+    Connection *conn = arg;
+
+    while (1) {
+        int n = input_recv(conn, 0);
+        if (n <= 0) {
+            if (n == 0) {
+                printf("Client disconnected\n");
+            } else {
+                fflush(stdout);
+                printf("Error reading from client\n");
+            }
+            if (conn->player != NULL && conn->player->socket == conn->socket) {
+                handle_logout(conn->player);
+            }
+            flush_dirty_connections();
+            break;
+        }
+
+        bool open = process_input(conn);
+        flush_dirty_connections();
+        if (!open) {
+            break;
+        }
+    }
+
+    close_connection(conn);
+    return NULL;
+}
+
+Player *process_login_command(int client_socket, char *buffer) {
+    char type[COMMAND_LENGTH];       // To hold "REGISTER" or "LOGIN"
+    char pseudo[MAX_PSEUDO_LEN];     // To hold the pseudo
+    char password[MAX_PASSWORD_LEN + 1]; // To hold the password
+    char protocol[sizeof(LOGIN_BINARY) + 1] = "";
+
+    int fields = sscanf(buffer, "%17s %10s %10s %7s", type, pseudo, password, protocol);
+    if (fields == 4 && strcmp(protocol, LOGIN_BINARY) != 0) {
+        printf("Invalid protocol.\n");
+        send_auth_status(client_socket, AUTH_BAD_REQUEST, "Unknown protocol");
+    } else if (fields >= 3) {
+        // Switch before the player becomes reachable so no text can slip into the stream
+        set_connection_binary(client_socket, fields == 4);
+        Player *player = NULL;
+        if (strcmp(type, "REGISTER") == 0) {
+            player = handle_registration(pseudo, password, client_socket);
+        } else if (strcmp(type, "LOGIN") == 0) {
+            player = handle_login(pseudo, password, client_socket);
+        } else {
+            printf("Invalid command type.\n");
+            send_auth_status(client_socket, AUTH_BAD_REQUEST, "Invalid command type");
+        }
+        if (player == NULL) {
+            set_connection_binary(client_socket, false);
+        }
+        return player;
+    } else {
+        printf("Invalid command format.\n");
+        send_auth_status(client_socket, AUTH_BAD_REQUEST, "Invalid command format");
+    }
+    return NULL;
+}
+
+CommandSpec commands[] = {
+        {LOGOUT,           handle_logout,           NULL,                  0, 0,                 NULL, 0},
+        {SHOW_PLAYERS,     send_all_players,        NULL,                  0, 0,                  NULL, 0},
+        {SHOW_ONLINE,      send_online_players,     NULL,                  0, 0,                  NULL, 0},
+        {TOP_ONLINE,       send_top_online_players, NULL,                  0, 0,                  NULL, 0},
+        {TOP,              send_top_players,        NULL,                  0, 0,                  NULL, 0},
+        {SHOW_GAMES,       send_active_games,       NULL,                  0, 0,                 NULL, 0},
+        {LEAVE_GAME,       handle_leave,            NULL,                  0, CMD_NEEDS_GAME,    NULL, 0},
+        {VIEW_BIO,         handle_see_bio,          NULL,                  0, 0,                 NULL, 0},
+        {VIEW_PLAYER_BIO,  NULL,                    handle_see_player_bio, 1, 0,                 "VIEW_PLAYER_BIO <pseudo>", 0},
+        {UPDATE_BIO,       NULL,                    handle_update_bio,     1, 0,                 "UPDATE_BIO <bio>", 0},
+        {CHALLENGE,        NULL,                    handle_challenge,      1, 0,                 "CHALLENGE <pseudo>", 0},
+        {REVOKE,           handle_revoke_challenge, NULL,                  0, 0,                 NULL, 0},
+        {PENDING,          send_pending_challenge,  NULL,                  0, 0,                 NULL, 0},
+        {ACCEPT,           accept_challenge,        NULL,                  0, 0,                 NULL, 0},
+        {DECLINE,          decline_challenge,       NULL,                  0, 0,                 NULL, 0},
+        {MAKE_MOVE,        NULL,                    make_move,             1, CMD_NEEDS_GAME,    "MAKE_MOVE <pit_number> [opponent]", 0},
+        {MY_GAMES,         send_my_games,           NULL,                  0, 0,                 NULL, 0},
+        {SWITCH_GAME,      NULL,                    handle_switch_game,    1, CMD_NEEDS_GAME,    "SWITCH_GAME <opponent>", 0},
+        {OBSERVE,          NULL,                    handle_observe,        1, 0,                 "OBSERVE <pseudo>", 0},
+        {QUIT_OBSERVE,     handle_quit_observe,     NULL,                  0, 0,                 NULL, 0},
+        {ADD_FRIEND,       NULL,                    handle_add_friend,     1, 0,                 "ADD_FRIEND <pseudo>", 0},
+        {REMOVE_FRIEND,    NULL,                    handle_remove_friend,  1, 0,                 "REMOVE_FRIEND <pseudo>", 0},
+        {VIEW_FRIEND_LIST, send_friend_list,        NULL,                  0, 0,                 NULL, 0},
+        {PRIVATE,          set_private,             NULL,                  0, 0,                 NULL, 0},
+        {PUBLIC,           set_public,              NULL,                  0, 0,                 NULL, 0},
+        {ACCESS,           send_access,             NULL,                  0, 0,                 NULL, 0},
+        {GLOBAL_MESSAGE,   NULL,                    send_global_message,   0, 0,                 NULL, 0},
+        {GAME_MESSAGE,     NULL,                    send_game_message,     0, 0,                 NULL, 0},
+        {DIRECT_MESSAGE,   NULL,                    send_direct_message,   2, 0,                 "DIRECT_MESSAGE <pseudo> <message>", 0},
+        {SAVE,             handle_save_game,        NULL,                  0, CMD_NEEDS_GAME,    NULL, 0},
+        {STATS,            send_server_stats,       NULL,                  0, 0,                 NULL, 0},
+};
+#define COMMAND_COUNT ((int) (sizeof(commands) / sizeof(commands[0])))
+
+CommandSpec *command_index[COMMAND_TABLE_SIZE];
+unsigned command_seed;
+
+// FNV-1a with the basis perturbed by the seed
+unsigned command_hash(unsigned seed, const char *token, size_t len) {
+    unsigned hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) token[i];
+        hash *= 16777619u;
+    }
+    return hash & (COMMAND_TABLE_SIZE - 1);
+}
+
+// Search for a seed that gives every command its own slot, done once before serving
+void build_command_table() {
+    for (unsigned seed = 0;; seed++) {
+        bool collision = false;
+        memset(command_index, 0, sizeof(command_index));
+        for (int i = 0; i < COMMAND_COUNT && !collision; i++) {
+            unsigned slot = command_hash(seed, commands[i].name, strlen(commands[i].name));
+            if (command_index[slot] != NULL) {
+                collision = true;
+            }
+            command_index[slot] = &commands[i];
+        }
+        if (!collision) {
+            command_seed = seed;
+            return;
+        }
+    }
+}
+
+// One hash and one compare, NULL for unknown commands
+CommandSpec *find_command(const char *token, size_t len) {
+    CommandSpec *spec = command_index[command_hash(command_seed, token, len)];
+    if (spec == NULL || strncmp(spec->name, token, len) != 0 || spec->name[len] != '\0') {
+        return NULL;
+    }
+    return spec;
+}
+
+// Single pass over the line, no copies: the command word and its space separated arguments
+void tokenize_command(char *line, Command *cmd) {
+    const char *p = line;
+    cmd->argc = 0;
+    cmd->name.len = 0;
+
+    while (*p != '\0') {
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        const char *start = p;
+        while (*p != ' ' && *p != '\0') {
+            p++;
+        }
 
-    while (1) {
-        /* Accept a client connection */
-        clilen = sizeof(cli_addr);
-        newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
-        if (newsockfd < 0) {
-            printf("Accept failed\n");
-            continue; // Continue to accept other clients
+        if (cmd->name.len == 0) {
+            cmd->name.ptr = start;
+            cmd->name.len = (int) (p - start);
+        } else {
+            if (cmd->argc < MAX_ARGS) {
+                cmd->args[cmd->argc].ptr = start;
+                cmd->args[cmd->argc].len = (int) (p - start);
+            }
+            cmd->argc++;
         }
+    }
+    cmd->end = p;
+}
 
-        printf("Connection accepted from %s:%d\n",
-               inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
+// Free text from argument `from` to the end of the line, NUL terminated, empty if absent
+Slice command_text(Command *cmd, int from) {
+    Slice text = {cmd->end, 0};
+    if (from < cmd->argc && from < MAX_ARGS) {
+        text.ptr = cmd->args[from].ptr;
+        text.len = (int) (cmd->end - text.ptr);
+    }
+    return text;
+}
 
-        /* Create a new thread for each client */
-        int *client_socket = malloc(sizeof(int));
-        *client_socket = newsockfd;
+bool slice_equals(Slice slice, const char *text) {
+    return strncmp(text, slice.ptr, slice.len) == 0 && text[slice.len] == '\0';
+}
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_client, client_socket) != 0) {
-            perror("Thread creation failed");
-            close(newsockfd);
-            free(client_socket);
-        } else {
-            pthread_detach(thread_id); // Detach the thread, so it cleans up automatically
+// Decimal digits only, short enough not to overflow
+bool slice_to_int(Slice slice, int *value) {
+    if (slice.len == 0 || slice.len > 9) {
+        return false;
+    }
+    int result = 0;
+    for (int i = 0; i < slice.len; i++) {
+        if (slice.ptr[i] < '0' || slice.ptr[i] > '9') {
+            return false;
         }
+        result = result * 10 + (slice.ptr[i] - '0');
     }
+    *value = result;
+    return true;
+}
 
-    close(sockfd);
-    return 0;
+void set_private(Player *player) {
+    update_access(player, 1);
 }
 
-void *handle_client(void *arg) {
-    int client_socket = *((int *) arg);
-    free(arg);
+void set_public(Player *player) {
+    update_access(player, 0);
+}
 
-    char buffer[BUFFER_SIZE];
-    int n;
-    Player *player;
+void process_command(Player *player, char *buffer) {
+    Command cmd;
+    tokenize_command(buffer, &cmd);
+    if (cmd.name.len == 0) {
+        return;
+    }
 
-    do {
-        n = read(client_socket, buffer, BUFFER_SIZE - 1);
-        if (n > 0) {
-            buffer[n] = '\0'; // Null-terminate the received string
-            char type[COMMAND_LENGTH];       // To hold "REGISTER" or "LOGIN"
-            char pseudo[MAX_PSEUDO_LEN];     // To hold the pseudo
-            char password[MAX_PASSWORD_LEN]; // To hold the password
-
-            if (sscanf(buffer, "%s %s %s", type, pseudo, password) == 3) {
-                if (strcmp(type, "REGISTER") == 0) {
-                    player = handle_registration(pseudo, password, client_socket);
-                } else if (strcmp(type, "LOGIN") == 0) {
-                    player = handle_login(pseudo, password, client_socket);
-                } else {
-                    printf("Invalid command type.\n");
-                    send_message(client_socket, "Invalid command type\n");
-                }
-            } else {
-                printf("Invalid command format.\n");
-                send_message(client_socket, "Invalid command format\n");
-            }
-        } else {
-            if (n == 0) {
-                printf("Client disconnected\n");
-                close(client_socket);
-            } else {
-                printf("Error reading from client\n");
-            }
-            return NULL;
-        }
-    } while (player == NULL);
+    CommandSpec *spec = find_command(cmd.name.ptr, cmd.name.len);
+    if (spec == NULL) {
+        printf("Unknown command: %.*s\n", cmd.name.len < COMMAND_LENGTH ? cmd.name.len : COMMAND_LENGTH - 1,
+               cmd.name.ptr);
+        return;
+    }
+    __atomic_add_fetch(&spec->calls, 1, __ATOMIC_RELAXED);
+
+    if (cmd.argc < spec->arity) {
+        char usage[BUFFER_SIZE];
+        snprintf(usage, sizeof(usage), "Invalid command format. Use: %s", spec->usage);
+        send_error(player->socket, usage);
+        return;
+    }
+    if ((spec->flags & CMD_NEEDS_GAME) && player->game_count == 0) {
+        send_error(player->socket, "You are not in the game");
+        return;
+    }
 
-    // User is logged in or registered, enter endless interaction loop
-    menu(player);
+    if (spec->handler != NULL) {
+        spec->handler(player);
+    } else {
+        spec->handler_args(player, &cmd);
+    }
 }
 
-void menu(Player *player) {
-    char buffer[BUFFER_SIZE];  // Buffer to hold the command received from the client
-    char command[COMMAND_LENGTH];  // Buffer to hold the command received from the client
-    int bytes_received;  // To store the number of bytes received from the socket
+// Load players from file
+// Accounts come from PLAYER_SNAPSHOT, or from the text PLAYER_FILE until the first compaction replaces it
+void load_players_from_file() {
+    if (!load_players_snapshot()) {
+        load_players_from_text();
+    }
+    replay_player_journal();
+}
 
-    while (1) {
-        // Read the command from the player's socket
-        bytes_received = read(player->socket, buffer, sizeof(buffer));
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
-                handle_logout(player);
-            } else {
-                fflush(stdout);
-                printf("Error reading from client\n");
-            }
-            return;
+// Maps PLAYER_SNAPSHOT and registers its accounts, false when there is none. A damaged snapshot stops the
+// server rather than letting the next compaction replace it with whatever else could be loaded.
+bool load_players_snapshot() {
+    int fd = open(PLAYER_SNAPSHOT, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    const unsigned char *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SnapshotHeader)) {
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    const SnapshotHeader *header = (const SnapshotHeader *) base;
+    uint64_t size = (uint64_t) st.st_size;
+    uint32_t record_size = base == MAP_FAILED ? 0 :
+                           header->version == 1 ? offsetof(SnapshotPlayer, wins) : sizeof(SnapshotPlayer);
+    if (base == MAP_FAILED || header->magic != SNAPSHOT_MAGIC || header->version < 1 ||
+        header->version > SNAPSHOT_VERSION ||
+        header->record_size != record_size ||
+        header->extra_offset < sizeof(SnapshotHeader) + (uint64_t) header->count * record_size ||
+        header->extra_offset > size || header->extra_size > size - header->extra_offset) {
+        printf("Unreadable player snapshot %s\n", PLAYER_SNAPSHOT);
+        exit(EXIT_FAILURE);
+    }
+
+    snapshot_records = base + sizeof(SnapshotHeader);
+    snapshot_record_size = record_size;
+    snapshot_extra = base + header->extra_offset;
+    results_loaded = header->version >= 2;
+    for (uint32_t i = 0; i < header->count; i++) {
+        const SnapshotPlayer *record = snapshot_player((int) i);
+        uint64_t len = record->password_len + (uint64_t) record->friend_count * MAX_PSEUDO_LEN + record->bio_len;
+        if (record->pseudo[MAX_PSEUDO_LEN - 1] != '\0' || record->friend_count > MAX_FRIENDS ||
+            record->bio_len >= MAX_BIO_LINES * MAX_BIO_LINE_LENGTH || record->extra > header->extra_size ||
+            len > header->extra_size - record->extra) {
+            printf("Damaged record %u in %s\n", i, PLAYER_SNAPSHOT);
+            exit(EXIT_FAILURE);
         }
-//        command[bytes_received] = '\0'; // Null-terminate the received string
-
-        // Extract the command (first word) before any space
-        sscanf(buffer, "%s", command);  // This will extract the first word into 'command'
-        // Process the command
-        if (strcmp(command, LOGOUT) == 0) {
-            handle_logout(player);
-        } else if (strcmp(command, SHOW_PLAYERS) == 0) {
-            send_all_players(player);
-        } else if (strcmp(command, SHOW_ONLINE) == 0) {
-            send_online_players(player);
-        } else if (strcmp(command, TOP_ONLINE) == 0) {
-            send_top_online_players(player);
-        } else if (strcmp(command, TOP) == 0) {
-            send_top_players(player);
-        } else if (strcmp(command, LEAVE_GAME) == 0) {
-            handle_leave(player);
-        } else if (strcmp(command, SHOW_GAMES) == 0) {
-            send_active_games(player);
-        } else if (strcmp(command, VIEW_BIO) == 0) {
-            handle_see_bio(player);
-        } else if (strcmp(command, VIEW_PLAYER_BIO) == 0) {
-            handle_see_player_bio(player, buffer);
-        } else if (strcmp(command, UPDATE_BIO) == 0) {
-            handle_update_bio(player, buffer);
-        } else if (strcmp(command, CHALLENGE) == 0) {
-            handle_challenge(player, buffer);
-        } else if (strcmp(command, REVOKE) == 0) {
-            handle_revoke_challenge(player);
-        } else if (strcmp(command, PENDING) == 0) {
-            send_pending_challenge(player);
-        } else if (strcmp(command, ACCEPT) == 0) {
-            accept_challenge(player);
-        } else if (strcmp(command, DECLINE) == 0) {
-            decline_challenge(player);
-        } else if (strcmp(command, MAKE_MOVE) == 0) {
-            make_move(player, buffer);
-        } else if (strcmp(command, SHOW_GAMES) == 0) {
-            send_active_games(player);
-        } else if (strcmp(command, OBSERVE) == 0) {
-            handle_observe(player, buffer);
-        } else if (strcmp(command, QUIT_OBSERVE) == 0) {
-            handle_quit_observe(player);
-        } else if (strcmp(command, ADD_FRIEND) == 0) {
-            handle_add_friend(player, buffer);
-        } else if (strcmp(command, REMOVE_FRIEND) == 0) {
-            handle_remove_friend(player, buffer);
-        } else if (strcmp(command, VIEW_FRIEND_LIST) == 0) {
-            send_friend_list(player);
-        } else if (strcmp(command, PRIVATE) == 0) {
-            update_access(player, 1);
-        } else if (strcmp(command, PUBLIC) == 0) {
-            update_access(player, 0);
-        } else if (strcmp(command, ACCESS) == 0) {
-            send_access(player);
-        } else if (strcmp(command, GLOBAL_MESSAGE) == 0) {
-            send_global_message(player, buffer);
-        } else if (strcmp(command, GAME_MESSAGE) == 0) {
-            send_game_message(player, buffer);
-        } else if (strcmp(command, DIRECT_MESSAGE) == 0) {
-            send_direct_message(player, buffer);
-        } else if (strcmp(command, SAVE) == 0) {
-            handle_save_game(player);
-        } else {
-            printf("Unknown command: %s\n", command);
+
+        Player *loaded = allocate_player();
+        if (loaded == NULL) {
+            printf("Player registry full, ignoring the remaining players\n");
+            break;
+        }
+        memcpy(loaded->pseudo, record->pseudo, MAX_PSEUDO_LEN);
+        loaded->private = record->private;
+        if (results_loaded) {
+            loaded->win_count = (int) record->wins;
+            loaded->loss_count = (int) record->losses;
+            loaded->draw_count = (int) record->draws;
+        }
+        loaded->snapshot_record = (int) i;
+        player_index_insert(loaded);
+    }
+    return true;
+}
+
+// Record of the mapped snapshot, whose fields past snapshot_record_size must not be read
+const SnapshotPlayer *snapshot_player(int record) {
+    return (const SnapshotPlayer *) (snapshot_records + (size_t) record * snapshot_record_size);
+}
+
+// Locks the player's profile, copying it out of the mapped snapshot the first time
+PlayerProfile *lock_profile(Player *player) {
+    PlayerProfile *profile = player->profile;
+    pthread_mutex_lock(&profile->lock);
+    if (player->snapshot_record >= 0) {
+        const SnapshotPlayer *record = snapshot_player(player->snapshot_record);
+        const unsigned char *data = snapshot_extra + record->extra;
+        memcpy(profile->password, data, record->password_len);
+        profile->password[record->password_len] = '\0';
+        data += record->password_len;
+        memcpy(profile->friends, data, record->friend_count * MAX_PSEUDO_LEN);
+        for (int j = 0; j < record->friend_count; j++) {
+            profile->friends[j][MAX_PSEUDO_LEN - 1] = '\0';
         }
-        memset(buffer, 0, sizeof(buffer));
+        profile->friend_count = record->friend_count;
+        data += record->friend_count * MAX_PSEUDO_LEN;
+        memcpy(profile->bio, data, record->bio_len);
+        profile->bio[record->bio_len] = '\0';
+        player->snapshot_record = -1;
     }
+    return profile;
 }
 
-// Load players from file
-void load_players_from_file() {
+// True where PTHREAD_MUTEX_INITIALIZER is all zero bits, as with glibc
+bool zeroed_mutex_is_unlocked() {
+    static const pthread_mutex_t zeroed;
+    pthread_mutex_t initializer = PTHREAD_MUTEX_INITIALIZER;
+    return memcmp(&initializer, &zeroed, sizeof(initializer)) == 0;
+}
+
+// Converts PLAYER_FILE and its journal into PLAYER_SNAPSHOT, for data written before the binary format
+void convert_players_file() {
+    if (access(PLAYER_SNAPSHOT, F_OK) == 0) {
+        printf("%s already exists and is loaded instead of %s\n", PLAYER_SNAPSHOT, PLAYER_FILE);
+        exit(EXIT_FAILURE);
+    }
+    load_players_from_text();
+    replay_player_journal();
+    compact_players_file();
+    if (access(PLAYER_SNAPSHOT, F_OK) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    printf("Converted %d players into %s\n", registered_players(), PLAYER_SNAPSHOT);
+}
+
+void load_players_from_text() {
     FILE *file = fopen(PLAYER_FILE, "r");
     if (file) {
         char pseudo[MAX_PSEUDO_LEN], password[HASH_SIZE];
@@ -470,78 +2749,61 @@ void load_players_from_file() {
         int private;
 
         while (fscanf(file, "%s %s %d", pseudo, password, &private) == 3) {
-            for (int i = 0; i < MAX_PLAYERS; i++) {
-                if (players[i].pseudo[0] == '\0') {
-                    // Fill player information
-                    strcpy(players[i].pseudo, pseudo);
-                    strcpy(players[i].password, password);
-                    players[i].is_online = false;
-                    players[i].private = private;
-                    players[i].socket = -1;
-                    players[i].game_id = -1;
-                    players[i].friend_count = 0;
-                    players[i].challenged_by[0] = '\0';
-                    players[i].challenged[0] = '\0';
-                    players[i].observing[0] = '\0';
-                    players[i].bio[0] = '\0';  // Initialize the bio to be empty
-
-                    // Initialize the friends array to empty strings
-                    for (int j = 0; j < MAX_FRIENDS; j++) {
-                        players[i].friends[j][0] = '\0';
+            Player *loaded = restore_player(pseudo, password, private);
+            if (loaded == NULL) {
+                printf("Player registry full, ignoring the remaining players\n");
+                break;
+            }
+
+            // Read through the file until "bio:" or "friends:" are processed
+            while (fgets(line, sizeof(line), file)) {
+                // Read friends list (looking for "friends:")
+                if (strncmp(line, "friends:", 8) == 0) {
+                    if (line[strlen(line) - 1] == '\n') {
+                        line[strlen(line) - 1] = '\0';
                     }
+                    char *friends_list = line + 9;
+                    char *friend_name = strtok(friends_list, " ");
 
-                    // Read through the file until "bio:" or "friends:" are processed
-                    while (fgets(line, sizeof(line), file)) {
-                        // Read friends list (looking for "friends:")
-                        if (strncmp(line, "friends:", 8) == 0) {
-                            if (line[strlen(line) - 1] == '\n') {
-                                line[strlen(line) - 1] = '\0';
-                            }
-                            char *friends_list = line + 9;
-                            char *friend_name = strtok(friends_list, " ");
-
-                            // Extract each friend's name
-                            while (friend_name != NULL && players[i].friend_count < MAX_FRIENDS) {
-                                if (strcmp(friend_name, "\n") == 0) {
-                                    break;
-                                }
-                                strncpy(players[i].friends[players[i].friend_count], friend_name,
-                                        MAX_PSEUDO_LEN - 1);
-                                players[i].friends[players[i].friend_count][MAX_PSEUDO_LEN - 1] = '\0';
-                                players[i].friend_count++;
-                                friend_name = strtok(NULL, " "); // Move to the next name
-                            }
+                    // Extract each friend's name
+                    while (friend_name != NULL && loaded->profile->friend_count < MAX_FRIENDS) {
+                        if (strcmp(friend_name, "\n") == 0) {
+                            break;
                         }
+                        strncpy(loaded->profile->friends[loaded->profile->friend_count], friend_name,
+                                MAX_PSEUDO_LEN - 1);
+                        loaded->profile->friends[loaded->profile->friend_count][MAX_PSEUDO_LEN - 1] = '\0';
+                        loaded->profile->friend_count++;
+                        friend_name = strtok(NULL, " "); // Move to the next name
+                    }
+                }
 
-                        // Read bio data (looking for "bio:")
-                        if (strncmp(line, "bio:", 4) == 0) {
-                            players[i].bio[0] = '\0';  // Clear bio before appending new content
-                            while (fgets(line, sizeof(line), file)) {
-                                if (strcmp(line, "\r\n") == 0) {
-                                    continue;
-                                }
-                                // If we hit the "-----" separator, we stop reading bio data
-                                if (strncmp(line, "-----", 5) == 0) {
-                                    break;
-                                }
-                                // Append bio content with a newline (remove trailing newline first)
-                                line[strcspn(line, "\n")] = 0;
-                                if (strlen(players[i].bio) > 0) {
-                                    strcat(players[i].bio, "\n");
-                                }
-                                strcat(players[i].bio, line);
-                            }
+                // Read bio data (looking for "bio:")
+                if (strncmp(line, "bio:", 4) == 0) {
+                    loaded->profile->bio[0] = '\0';  // Clear bio before appending new content
+                    while (fgets(line, sizeof(line), file)) {
+                        if (strcmp(line, "\r\n") == 0) {
+                            continue;
                         }
-
-                        // Stop processing after reaching the separator
+                        // If we hit the "-----" separator, we stop reading bio data
                         if (strncmp(line, "-----", 5) == 0) {
                             break;
                         }
+                        // Append bio content with a newline (remove trailing newline first)
+                        line[strcspn(line, "\n")] = 0;
+                        if (strlen(loaded->profile->bio) > 0) {
+                            strcat(loaded->profile->bio, "\n");
+                        }
+                        strcat(loaded->profile->bio, line);
                     }
+                }
 
+                // Stop processing after reaching the separator
+                if (strncmp(line, "-----", 5) == 0) {
                     break;
                 }
             }
+
         }
         fclose(file);
     } else {
@@ -556,106 +2818,530 @@ void load_players_from_file() {
     }
 }
 
+// Registers an account read back from disk, NULL when the registry is full
+Player *restore_player(const char *pseudo, const char *password, int private) {
+    Player *loaded = allocate_player();
+    if (loaded == NULL) {
+        return NULL;
+    }
+    // Fill player information, the slot comes zeroed so friends and bio start empty
+    strcpy(loaded->pseudo, pseudo);
+    strcpy(loaded->profile->password, password);
+    player_index_insert(loaded);
+    loaded->is_online = false;
+    loaded->private = private;
+    loaded->socket = -1;
+    return loaded;
+}
 
-Player *find_player_by_pseudo(const char *pseudo) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (strcmp(players[i].pseudo, pseudo) == 0) {
-            return &players[i];
+// Applies the changes journaled since the last compaction, then keeps the journal open for appending
+void replay_player_journal() {
+    FILE *file = fopen(PLAYER_JOURNAL, "r");
+    if (file) {
+        char record[2 * MAX_BIO_LINES * MAX_BIO_LINE_LENGTH + 64];
+        while (fgets(record, sizeof(record), file)) {
+            size_t len = strlen(record);
+            if (len == 0 || record[len - 1] != '\n') {
+                break;  // Torn last record of a crash
+            }
+            record[len - 1] = '\0';
+            if (!apply_journal_record(record)) {
+                printf("Skipping journal record: %s\n", record);
+            }
+            journal_records++;
+        }
+        fclose(file);
+        if (journal_records > 0) {
+            printf("Replayed %d player journal records\n", journal_records);
         }
     }
-    return NULL;
+
+    journal_file = fopen(PLAYER_JOURNAL, "a");
+    if (!journal_file) {
+        perror("Failed to open player journal");
+    }
 }
 
-/*
-void backup_file() {
-    char backup_path[256];
-    snprintf(backup_path, sizeof(backup_path), "%s.bak", PLAYER_FILE);
+// Records are idempotent, replaying one already contained in the snapshot changes nothing
+bool apply_journal_record(char *record) {
+    char kind[16], pseudo[MAX_PSEUDO_LEN], arg[HASH_SIZE];
+    int value;
+    if (sscanf(record, "%15s %10s", kind, pseudo) != 2) {
+        return false;
+    }
 
-    FILE *original_file = fopen(PLAYER_FILE, "r");
-    if (!original_file) {
-        perror("Error opening original file for backup");
-        return;
+    Player *player = find_player_by_pseudo(pseudo);
+    if (strcmp(kind, "REGISTER") == 0) {
+        if (sscanf(record, "%*s %*s %255s %d", arg, &value) != 2) {
+            return false;
+        }
+        return player != NULL || restore_player(pseudo, arg, value) != NULL;
     }
+    if (player == NULL) {
+        return false;
+    }
+    PlayerProfile *profile = lock_profile(player);  // Runs before serving, only to fill it from the snapshot
+    pthread_mutex_unlock(&profile->lock);
 
-    FILE *backup_file = fopen(backup_path, "w");
-    if (!backup_file) {
-        perror("Error opening backup file");
-        fclose(original_file);
-        return;
+    if (strcmp(kind, "ACCESS") == 0) {
+        if (sscanf(record, "%*s %*s %d", &value) != 1) {
+            return false;
+        }
+        player->private = value;
+    } else if (strcmp(kind, "RESULTS") == 0) {
+        // Totals rather than the game, so replaying it twice counts nothing twice
+        int wins, losses, draws;
+        if (sscanf(record, "%*s %*s %d %d %d", &wins, &losses, &draws) != 3) {
+            return false;
+        }
+        player->win_count = wins;
+        player->loss_count = losses;
+        player->draw_count = draws;
+    } else if (strcmp(kind, "BIO") == 0) {
+        // Rest of the line after "BIO <pseudo> ", with newlines and backslashes escaped
+        const char *text = record + strlen(kind) + 1 + strlen(pseudo);
+        int j = 0;
+        if (*text == ' ') {
+            text++;
+        }
+        for (; *text != '\0' && j < (int) sizeof(profile->bio) - 1; text++) {
+            if (*text == '\\' && text[1] != '\0') {
+                text++;
+                profile->bio[j++] = *text == 'n' ? '\n' : *text;
+            } else {
+                profile->bio[j++] = *text;
+            }
+        }
+        profile->bio[j] = '\0';
+    } else if (strcmp(kind, "FRIEND_ADD") == 0 || strcmp(kind, "FRIEND_REMOVE") == 0) {
+        if (sscanf(record, "%*s %*s %10s", arg) != 1) {
+            return false;
+        }
+        int index = -1;
+        for (int i = 0; i < profile->friend_count; i++) {
+            if (strcmp(profile->friends[i], arg) == 0) {
+                index = i;
+                break;
+            }
+        }
+        if (kind[7] == 'A') {
+            if (index == -1 && profile->friend_count < MAX_FRIENDS) {
+                strcpy(profile->friends[profile->friend_count++], arg);
+            }
+        } else if (index != -1) {
+            for (int i = index; i < profile->friend_count - 1; i++) {
+                strcpy(profile->friends[i], profile->friends[i + 1]);
+            }
+            profile->friends[--profile->friend_count][0] = '\0';
+        }
+    } else {
+        return false;
     }
+    return true;
+}
 
-    // Copy the contents of the original file to the backup file
-    char ch;
-    while ((ch = fgetc(original_file)) != EOF) {
-        fputc(ch, backup_file);
+// Queues one profile change for the journal, with DURABILITY_EVERY_WRITE it returns once it is on disk
+void journal_player_change(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    unsigned long sequence = format_player_change(format, args);
+    va_end(args);
+    wait_for_disk(sequence);
+}
+
+// Queues one profile change without waiting for the disk, safe under any lock. Returns its sequence number.
+unsigned long queue_player_change(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    unsigned long sequence = format_player_change(format, args);
+    va_end(args);
+    return sequence;
+}
+
+unsigned long format_player_change(const char *format, va_list args) {
+    char record[2 * MAX_BIO_LINES * MAX_BIO_LINE_LENGTH + 64];
+    int len = vsnprintf(record, sizeof(record) - 1, format, args);
+    if (len < 0) {
+        return 0;
     }
+    if (len > (int) sizeof(record) - 2) {
+        len = (int) sizeof(record) - 2;
+    }
+    record[len++] = '\n';
+    return queue_record(PERSIST_PLAYERS, record, len);
+}
 
-    fclose(original_file);
-    fclose(backup_file);
+// Hands a record to the persistence thread, with DURABILITY_EVERY_WRITE it returns once the record is on disk.
+// Records are written in the order they were queued.
+void persist_record(PersistTarget target, const char *data, int len) {
+    wait_for_disk(queue_record(target, data, len));
 }
 
-void restore_from_backup() {
-    char backup_path[256];
-    snprintf(backup_path, sizeof(backup_path), "%s.bak", PLAYER_FILE);
+// Hands a record to the persistence thread without waiting, returns its sequence number or 0 if it was lost
+unsigned long queue_record(PersistTarget target, const char *data, int len) {
+    PersistRecord *record = malloc(sizeof(PersistRecord) + len);
+    if (record == NULL) {
+        perror("Failed to queue record for disk");
+        return 0;
+    }
+    record->next = NULL;
+    record->target = target;
+    record->len = len;
+    memcpy(record->data, data, len);
+
+    pthread_mutex_lock(&persist_mutex);
+    if (persist_tail != NULL) {
+        persist_tail->next = record;
+    } else {
+        persist_head = record;
+    }
+    persist_tail = record;
+    if (++persist_depth > persist_peak_depth) {
+        persist_peak_depth = persist_depth;
+    }
+    unsigned long sequence = ++persist_queued;
+    if (persist_depth == 1 || persist_depth >= flush_batch) {
+        pthread_cond_signal(&persist_cond);
+    }
+    pthread_mutex_unlock(&persist_mutex);
+    return sequence;
+}
 
-    FILE *backup_file = fopen(backup_path, "r");
-    if (!backup_file) {
-        perror("Error opening backup file for restoration");
+// With DURABILITY_EVERY_WRITE, returns once every record up to sequence is on disk. Caller holds no
+// Game.lock nor PlayerProfile.lock.
+void wait_for_disk(unsigned long sequence) {
+    if (durability != DURABILITY_EVERY_WRITE || sequence == 0) {
         return;
     }
+    pthread_mutex_lock(&persist_mutex);
+    while (persist_committed < sequence) {
+        pthread_cond_wait(&persist_done_cond, &persist_mutex);
+    }
+    pthread_mutex_unlock(&persist_mutex);
+}
 
-    FILE *file = fopen(PLAYER_FILE, "w");
-    if (!file) {
-        perror("Error opening original file for restoration");
-        fclose(backup_file);
-        return;
+void start_persistence() {
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, run_persistence, NULL) != 0) {
+        perror("Persistence thread creation failed");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread_id);
+}
+
+// Takes the whole queue at once, so a burst of changes costs one write and one fsync per file
+void *run_persistence(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&persist_mutex);
+    for (;;) {
+        while (persist_head == NULL) {
+            pthread_cond_wait(&persist_cond, &persist_mutex);
+        }
+
+        if (durability == DURABILITY_BATCHED) {
+            // Let the batch fill up to the interval, the first record bounds how long anyone waits
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long) flush_interval_ms * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while (persist_depth < flush_batch &&
+                   pthread_cond_timedwait(&persist_cond, &persist_mutex, &deadline) != ETIMEDOUT) {
+            }
+        }
+
+        PersistRecord *batch = persist_head;
+        unsigned long last = persist_queued;
+        persist_head = persist_tail = NULL;
+        persist_depth = 0;
+        pthread_mutex_unlock(&persist_mutex);
+
+        long elapsed = write_persist_batch(batch);
+        int registered = registered_players();
+        bool compact = journal_records >= (registered > JOURNAL_COMPACT_MIN ? registered : JOURNAL_COMPACT_MIN);
+
+        pthread_mutex_lock(&persist_mutex);
+        persist_committed = last;
+        persist_flushes++;
+        persist_last_flush_us = elapsed;
+        if (elapsed > persist_max_flush_us) {
+            persist_max_flush_us = elapsed;
+        }
+        pthread_cond_broadcast(&persist_done_cond);
+
+        // Compaction takes every profile lock, so writers are released first and nobody waits on it
+        if (compact) {
+            pthread_mutex_unlock(&persist_mutex);
+            compact_players_file();
+            pthread_mutex_lock(&persist_mutex);
+        }
+    }
+    return NULL;
+}
+
+// Writes and frees a batch. Returns microseconds spent.
+long write_persist_batch(PersistRecord *batch) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool players_written = false;
+    bool games_written = false;
+    while (batch != NULL) {
+        PersistRecord *next = batch->next;
+        if (batch->target == PERSIST_PLAYERS) {
+            if (journal_file != NULL && fwrite(batch->data, 1, batch->len, journal_file) != (size_t) batch->len) {
+                perror("Failed to write record");
+            }
+            players_written = true;
+            journal_records++;
+        } else {
+            archive_game(batch->data, batch->len);
+            games_written = true;
+        }
+        free(batch);
+        batch = next;
     }
 
-    // Copy the contents of the backup file to the original file
-    char ch;
-    while ((ch = fgetc(backup_file)) != EOF) {
-        fputc(ch, file);
+    // The archive reaches the disk before the index entries pointing into it
+    FILE *files[3] = {players_written ? journal_file : NULL, games_written ? game_archive : NULL,
+                      games_written ? game_index : NULL};
+    for (int i = 0; i < 3; i++) {
+        if (files[i] == NULL) {
+            continue;
+        }
+        if (fflush(files[i]) != 0 || (durability != DURABILITY_NONE && fsync(fileno(files[i])) != 0)) {
+            perror("Failed to flush records");
+        }
     }
 
-    fclose(backup_file);
-    fclose(file);
-    printf("File restored from backup.\n");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
 }
- */
 
-void update_players_file() {
-    pthread_mutex_lock(&player_mutex);
 
-    FILE *file = fopen(PLAYER_FILE, "w");
-    if (!file) {
-        perror("Error opening file for writing");
+Player *find_player_by_pseudo(const char *pseudo) {
+    return find_player(pseudo, (int) strlen(pseudo));
+}
+
+// Lookup by length-delimited name, so command arguments need no copy
+Player *find_player(const char *pseudo, int len) {
+    if (len == 0 || len >= MAX_PSEUDO_LEN) {
+        return NULL;
+    }
+    unsigned hash = pseudo_hash(pseudo, len);
+    Player *found = NULL;
+
+    pthread_rwlock_rdlock(&player_index_lock);
+    if (player_index != NULL) {
+        unsigned mask = player_index_capacity - 1;
+        for (unsigned slot = hash & mask; player_index[slot].player != NULL; slot = (slot + 1) & mask) {
+            Player *candidate = player_index[slot].player;
+            if (player_index[slot].hash == hash && strncmp(candidate->pseudo, pseudo, len) == 0 &&
+                candidate->pseudo[len] == '\0') {
+                found = candidate;
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&player_index_lock);
+    return found;
+}
+
+// Next free registry slot, zeroed, caller holds registry_mutex (or runs before serving)
+Player *allocate_player() {
+    int index = player_count;
+    int chunk = index >> PLAYER_CHUNK_SHIFT;
+    if (chunk >= MAX_PLAYER_CHUNKS) {
+        return NULL;
+    }
+    if (profile_chunks[chunk] == NULL) {
+        profile_chunks[chunk] = calloc(PLAYER_CHUNK_SIZE, sizeof(PlayerProfile));
+        if (profile_chunks[chunk] == NULL) {
+            perror("Failed to grow player registry");
+            return NULL;
+        }
+    }
+    if (player_chunks[chunk] == NULL) {
+        player_chunks[chunk] = calloc(PLAYER_CHUNK_SIZE, sizeof(Player));
+        if (player_chunks[chunk] == NULL) {
+            perror("Failed to grow player registry");
+            return NULL;
+        }
+    }
+    Player *player = &player_chunks[chunk][index & (PLAYER_CHUNK_SIZE - 1)];
+    player->profile = &profile_chunks[chunk][index & (PLAYER_CHUNK_SIZE - 1)];
+    // Slots are never reused, so the profile is still zeroed; where that already is an unlocked mutex, leaving
+    // it untouched keeps a million-account startup from faulting in every cold page
+    if (!zeroed_mutex_is_unlocked()) {
+        pthread_mutex_init(&player->profile->lock, NULL);
+    }
+    player->socket = -1;
+    player->online_index = -1;
+    player->snapshot_record = -1;
+
+    // Publish the slot, scans without registry_mutex see it blank until the pseudo is set
+    __atomic_store_n(&player_count, index + 1, __ATOMIC_RELEASE);
+    return player;
+}
+
+// Caller holds registry_mutex
+bool add_online_player(Player *player) {
+    if (online_set_count == online_set_capacity) {
+        int capacity = online_set_capacity > 0 ? online_set_capacity * 2 : MAX_ONLINE_PLAYERS;
+        Player **set = realloc(online_set, capacity * sizeof(Player *));
+        if (set == NULL) {
+            perror("Failed to grow online set");
+            return false;
+        }
+        online_set = set;
+        online_set_capacity = capacity;
+    }
+    player->online_index = online_set_count;
+    online_set[online_set_count++] = player;
+    invalidate_listings(LISTING_BIT(LISTING_ONLINE) | LISTING_BIT(LISTING_TOP_ONLINE));
+    return true;
+}
+
+// Swap-remove, caller holds registry_mutex
+void remove_online_player(Player *player) {
+    if (player->online_index == -1) {
         return;
     }
+    Player *last = online_set[--online_set_count];
+    online_set[player->online_index] = last;
+    last->online_index = player->online_index;
+    player->online_index = -1;
+    invalidate_listings(LISTING_BIT(LISTING_ONLINE) | LISTING_BIT(LISTING_TOP_ONLINE));
+}
 
-    // Write all players to the file
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].pseudo[0] != '\0') {  // Check if player slot is not empty
-            fprintf(file, "%s %s %d\n", players[i].pseudo, players[i].password, players[i].private);
+int registered_players() {
+    return __atomic_load_n(&player_count, __ATOMIC_ACQUIRE);
+}
 
-            // Write friends to the file
-            fprintf(file, "friends: ");
-            for (int j = 0; j < MAX_FRIENDS && players[i].friends[j][0] != '\0'; j++) {
-                fprintf(file, "%s ", players[i].friends[j]);
-            }
-            fprintf(file, "\n");
+Player *player_at(int index) {
+    return &player_chunks[index >> PLAYER_CHUNK_SHIFT][index & (PLAYER_CHUNK_SIZE - 1)];
+}
+
+// FNV-1a over the pseudo
+unsigned pseudo_hash(const char *pseudo, int len) {
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char) pseudo[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-            // Write bio to the file
-            fprintf(file, "bio:\n");
-            if (players[i].bio[0] != '\0') {
-                fprintf(file, "%s\n", players[i].bio);
+// Called once the pseudo is set, on load and registration; the index never shrinks
+void player_index_insert(Player *player) {
+    pthread_rwlock_wrlock(&player_index_lock);
+
+    if ((player_index_count + 1) * 10 > player_index_capacity * 7) {
+        int capacity = player_index_capacity > 0 ? player_index_capacity * 2 : PLAYER_INDEX_INITIAL;
+        PlayerIndexEntry *index = calloc(capacity, sizeof(PlayerIndexEntry));
+        if (index == NULL) {
+            perror("Failed to grow player index");
+            pthread_rwlock_unlock(&player_index_lock);
+            return;
+        }
+        for (int i = 0; i < player_index_capacity; i++) {
+            if (player_index[i].player != NULL) {
+                unsigned slot = player_index[i].hash & (capacity - 1);
+                while (index[slot].player != NULL) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                index[slot] = player_index[i];
             }
+        }
+        free(player_index);
+        player_index = index;
+        player_index_capacity = capacity;
+    }
+
+    unsigned hash = pseudo_hash(player->pseudo, (int) strlen(player->pseudo));
+    unsigned mask = player_index_capacity - 1;
+    unsigned slot = hash & mask;
+    while (player_index[slot].player != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    player_index[slot].hash = hash;
+    player_index[slot].player = player;
+    player_index_count++;
+
+    pthread_rwlock_unlock(&player_index_lock);
+}
+
+// Folds the journal into a fresh PLAYER_SNAPSHOT, runs on the persistence thread between batches.
+// The snapshot replaces the old one atomically; a crash before the journal is emptied only replays it again.
+void compact_players_file() {
+    char snapshot_path[256];
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.tmp", PLAYER_SNAPSHOT);
+
+    int reserved = registered_players();
+    SnapshotPlayer *records = calloc(reserved > 0 ? reserved : 1, sizeof(SnapshotPlayer));
+    FILE *file = records != NULL ? fopen(snapshot_path, "w") : NULL;
+    if (!file) {
+        perror("Error opening file for writing");
+        free(records);
+        return;
+    }
 
-            fprintf(file, "-----\n");
+    // The variable area is streamed after room for every record, the table is written once it is complete
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, sizeof(SnapshotPlayer), 0,
+                             sizeof(SnapshotHeader) + (uint64_t) reserved * sizeof(SnapshotPlayer), 0};
+    fseeko(file, (off_t) header.extra_offset, SEEK_SET);
+    for (int i = 0; i < reserved; i++) {
+        Player *entry = player_at(i);
+        PlayerProfile *profile = entry->profile;
+        pthread_mutex_lock(&profile->lock);
+        if (entry->pseudo[0] != '\0' && entry->snapshot_record >= 0) {
+            // Never used since startup, its data is still in the mapped snapshot
+            const SnapshotPlayer *stored = snapshot_player(entry->snapshot_record);
+            size_t len = stored->password_len + stored->friend_count * MAX_PSEUDO_LEN + stored->bio_len;
+            SnapshotPlayer *record = &records[header.count++];
+            memcpy(record, stored, snapshot_record_size);
+            record->private = entry->private;
+            record->wins = (uint32_t) entry->win_count;
+            record->losses = (uint32_t) entry->loss_count;
+            record->draws = (uint32_t) entry->draw_count;
+            record->extra = header.extra_size;
+            fwrite(snapshot_extra + stored->extra, 1, len, file);
+            header.extra_size += len;
+        } else if (entry->pseudo[0] != '\0') {  // Check if player slot is not empty
+            SnapshotPlayer *record = &records[header.count++];
+            memcpy(record->pseudo, entry->pseudo, MAX_PSEUDO_LEN);
+            record->private = entry->private;
+            record->wins = (uint32_t) entry->win_count;
+            record->losses = (uint32_t) entry->loss_count;
+            record->draws = (uint32_t) entry->draw_count;
+            record->friend_count = (uint8_t) profile->friend_count;
+            record->password_len = (uint8_t) strlen(profile->password);
+            record->bio_len = (uint16_t) strlen(profile->bio);
+            record->extra = header.extra_size;
+
+            fwrite(profile->password, 1, record->password_len, file);
+            fwrite(profile->friends, MAX_PSEUDO_LEN, record->friend_count, file);
+            fwrite(profile->bio, 1, record->bio_len, file);
+            header.extra_size += record->password_len + record->friend_count * MAX_PSEUDO_LEN + record->bio_len;
         }
+        pthread_mutex_unlock(&profile->lock);
     }
 
-    fclose(file);
-    pthread_mutex_unlock(&player_mutex);
+    rewind(file);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(records, sizeof(SnapshotPlayer), header.count, file);
+    free(records);
+
+    bool written = !ferror(file) && fflush(file) == 0 && (durability == DURABILITY_NONE || fsync(fileno(file)) == 0);
+    if (fclose(file) != 0 || !written || rename(snapshot_path, PLAYER_SNAPSHOT) != 0) {
+        perror("Failed to write player snapshot");
+        return;
+    }
+    if (journal_file != NULL && ftruncate(fileno(journal_file), 0) != 0) {
+        perror("Failed to truncate player journal");
+        return;
+    }
+    journal_records = 0;
     printf("File updated successfully.\n");
 }
 
@@ -667,30 +3353,21 @@ void send_access(Player *player) {
     }
 }
 
-void send_game_message(Player *player, char *buffer) {
+void send_game_message(Player *player, Command *cmd) {
     char message[BUFFER_SIZE];
 
-    // Clear the message buffer
-    memset(message, 0, sizeof(message));
-
     // Format the message
-    snprintf(message, sizeof(message), "GAME %s: %s\n", player->pseudo, buffer + strlen("GAME_MESSAGE "));
+    const char *body = command_text(cmd, 0).ptr;
+    snprintf(message, sizeof(message), "GAME %s: %s\n", player->pseudo, body);
 
-    Game *game = NULL;  // Initialize game to NULL
-
-    if (player->game_id != -1) {
-        game = active_games[player->game_id];  // Find game by game_id
-    } else if (player->observing[0] != '\0') {
-        Player *playing = find_player_by_pseudo(player->observing);  // Find player being observed
-        if (playing != NULL) {
-            game = active_games[playing->game_id];  // Find game of the observed player
-        }
+    Game *game = acquire_player_game(player);  // The player's own game first
+    if (game == NULL) {
+        game = acquire_game(__atomic_load_n(&player->observing, __ATOMIC_RELAXED));  // Then the observed one
     }
 
 // Check if the game is found
     if (game == NULL) {
-        send_message(player->socket, "Game not found\n");  // Send message if game is not found
-        memset(message, 0, sizeof(message));  // Clear message buffer
+        send_error(player->socket, "Game not found");  // Send message if game is not found
         return;  // Exit the function
     }
 
@@ -699,109 +3376,100 @@ void send_game_message(Player *player, char *buffer) {
     if (strcmp(player->pseudo, game->player1->pseudo) == 0) {
         skip_check = 1;
     } else {
-        send_message(game->player1->socket, message);
+        send_chat(game->player1->socket, CHAT_GAME, player->pseudo, body, message);
     }
 
     if (skip_check) {
-        send_message(game->player2->socket, message);
+        send_chat(game->player2->socket, CHAT_GAME, player->pseudo, body, message);
     } else if (strcmp(player->pseudo, game->player2->pseudo) == 0) {
-        skip_check = 1;
-    }
-
-    for (int i = 0; i < game->observer_count; ++i) {
-        if (skip_check) {
-            send_message(game->observers[i]->socket, message);
-        } else if (strcmp(player->pseudo, game->observers[i]->pseudo) == 0) {
-            skip_check = 1;
-        }
-    }
-
-    memset(message, 0, sizeof(message));
-
-}
-
-
-void send_global_message(Player *player, char *buffer) {
-    char message[BUFFER_SIZE];
-
-    // Clear the message buffer
-    memset(message, 0, sizeof(message));
-
-    // Format the messagef
-    snprintf(message, sizeof(message), "GL %s: %s\n", player->pseudo, buffer + strlen("GLOBAL_MESSAGE "));
+        skip_check = 1;
+    }
 
-    // Iterate over all players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].is_online) {
-            // Skip sending the message to the sender
-            if (strcmp(players[i].pseudo, player->pseudo) == 0) {
-                continue;
-            }
-            // Send the message to other online players
-            send_message(players[i].socket, message);
+    for (int i = 0; i < game->observer_count; ++i) {
+        if (skip_check) {
+            send_chat(game->observers[i]->socket, CHAT_GAME, player->pseudo, body, message);
+        } else if (strcmp(player->pseudo, game->observers[i]->pseudo) == 0) {
+            skip_check = 1;
         }
     }
-
-    // Ensure the buffer is cleared after use
-    memset(message, 0, sizeof(message));
+    release_game(game);
 }
 
 
-void send_direct_message(Player *player, char *buffer) {
+void send_global_message(Player *player, Command *cmd) {
     char message[BUFFER_SIZE];
-    char pseudo[BUFFER_SIZE];
-
-    memset(message, 0, sizeof(message));
-    memset(pseudo, 0, sizeof(pseudo));
 
-    // Extract pseudo and message from the buffer
-    if (sscanf(buffer, "DIRECT_MESSAGE %s %[^\n]", pseudo, message) != 2) {
-        printf("Invalid command format.\n");
-        memset(pseudo, 0, sizeof(pseudo));
-        memset(message, 0, sizeof(message));
+    // Format the message
+    const char *body = command_text(cmd, 0).ptr;
+    snprintf(message, sizeof(message), "GL %s: %s\n", player->pseudo, body);
+
+    // Copy the other online players' sockets, then send without holding registry_mutex
+    pthread_mutex_lock(&registry_mutex);
+    int *sockets = malloc(online_set_count * sizeof(int));
+    if (sockets == NULL) {
+        pthread_mutex_unlock(&registry_mutex);
+        perror("Failed to allocate global message recipients");
         return;
     }
+    int count = 0;
+    for (int i = 0; i < online_set_count; i++) {
+        if (online_set[i] != player) {
+            sockets[count++] = online_set[i]->socket;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
 
+    for (int i = 0; i < count; i++) {
+        send_chat(sockets[i], CHAT_GLOBAL, player->pseudo, body, message);
+    }
+    free(sockets);
+}
+
+
+void send_direct_message(Player *player, Command *cmd) {
+    // The dispatcher guarantees a pseudo and at least one word of message
+    const char *message = command_text(cmd, 1).ptr;
 
-    Player *target = find_player_by_pseudo(pseudo);
+    Player *target = find_player(cmd->args[0].ptr, cmd->args[0].len);
     if (target == NULL) {
-        send_message(player->socket, "Player not found\n");
-        memset(pseudo, 0, sizeof(pseudo));
-        memset(message, 0, sizeof(message));
+        send_error(player->socket, "Player not found");
         return;
     }
     if (!target->is_online) {
-        send_message(player->socket, "Player is not online\n");
-        memset(pseudo, 0, sizeof(pseudo));
-        memset(message, 0, sizeof(message));
+        send_error(player->socket, "Player is not online");
         return;
     }
 
-
     char formatted_message[BUFFER_SIZE];
     snprintf(formatted_message, sizeof(formatted_message), "From %s: %s\n", player->pseudo, message);
 
-    send_message(target->socket, formatted_message);
-
-    memset(pseudo, 0, sizeof(pseudo));
-    memset(message, 0, sizeof(message));
+    send_chat(target->socket, CHAT_DIRECT, player->pseudo, message, formatted_message);
 }
 
 void update_access(Player *player, int private) {
+    lock_profile(player);
     player->private = private;
-    if (player->game_id != -1 && private) {
-        update_observers(player->game_id);
+    pthread_mutex_unlock(&player->profile->lock);
+
+    if (player->game_count > 0 && private) {
+        update_observers(player);
     }
-    update_players_file();
+    journal_player_change("ACCESS %s %d", player->pseudo, private);
     send_access(player);
 }
 
 void handle_see_bio(Player *player) {
-    char bio_output[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH] = "Bio:\n";
+    char bio_output[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH + 8] = "Bio:\n";
 
-    if (strlen(player->bio) > 0) {
-        strcat(bio_output, player->bio);
+    lock_profile(player);
+    bool has_bio = strlen(player->profile->bio) > 0;
+    if (has_bio) {
+        strcat(bio_output, player->profile->bio);
         strcat(bio_output, "\n");
+    }
+    pthread_mutex_unlock(&player->profile->lock);
+
+    if (has_bio) {
         send_message(player->socket, bio_output);
     } else {
         send_message(player->socket, "You haven't added a bio yet.\n");
@@ -809,26 +3477,18 @@ void handle_see_bio(Player *player) {
     memset(bio_output, 0, sizeof(bio_output));
 }
 
-void handle_update_bio(Player *player, char *command) {
-    // Create a buffer to hold the entire bio
-    char bio[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH];
-    memset(bio, 0, sizeof(bio));  // Clear the buffer before use
-
-    // Extract the bio content from the command
-    if (sscanf(command, "UPDATE_BIO %[^\n]", bio) != 1) {
-        send_message(player->socket, "Error reading bio\n");
-        memset(bio, 0, sizeof(bio));
-        return;
-    }
+void handle_update_bio(Player *player, Command *cmd) {
+    Slice bio = command_text(cmd, 0);
 
+    // Unescape "\n" straight into the player's bio
     char processed_bio[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH];
     int j = 0;
-    for (int i = 0; bio[i] != '\0'; i++) {
-        if (bio[i] == '\\' && bio[i + 1] == 'n') {
+    for (int i = 0; i < bio.len && j < (int) sizeof(processed_bio) - 1; i++) {
+        if (bio.ptr[i] == '\\' && i + 1 < bio.len && bio.ptr[i + 1] == 'n') {
             processed_bio[j++] = '\n'; // Add a newline
             i++;                      // Skip the 'n'
         } else {
-            processed_bio[j++] = bio[i];
+            processed_bio[j++] = bio.ptr[i];
         }
     }
     processed_bio[j] = '\0'; // Null-terminate the string
@@ -837,280 +3497,395 @@ void handle_update_bio(Player *player, char *command) {
     }
 
     // Save the processed bio to the player's bio
-    strncpy(player->bio, processed_bio, sizeof(player->bio) - 1);
-    player->bio[sizeof(player->bio) - 1] = '\0'; // Ensure null termination
-
-    update_players_file();
+    lock_profile(player);
+    // Same size as the bio and always terminated, the copy cannot overrun
+    memcpy(player->profile->bio, processed_bio, strlen(processed_bio) + 1);
+    pthread_mutex_unlock(&player->profile->lock);
+
+    // Journal it on one line, escaping newlines and backslashes
+    char escaped[2 * sizeof(processed_bio)];
+    int len = 0;
+    for (int i = 0; processed_bio[i] != '\0'; i++) {
+        if (processed_bio[i] == '\n' || processed_bio[i] == '\\') {
+            escaped[len++] = '\\';
+        }
+        escaped[len++] = processed_bio[i] == '\n' ? 'n' : processed_bio[i];
+    }
+    escaped[len] = '\0';
+    journal_player_change("BIO %s %s", player->pseudo, escaped);
 
     // Send confirmation to the client
     send_message(player->socket, "Your bio has been updated successfully.\n");
-    memset(bio, 0, sizeof(bio));
 }
 
 
-void handle_see_player_bio(Player *player_target, char *command) {
-    char pseudo[MAX_PSEUDO_LEN];
-    if (sscanf(command, "VIEW_PLAYER_BIO %10s", pseudo) == 1) { // Limit pseudo to MAX_PSEUDO_LEN
-        // Validate the pseudo
-        if (strlen(pseudo) == 0 || strlen(pseudo) > MAX_PSEUDO_LEN) {
-            send_message(player_target->socket, "Error reading pseudo\n");
-            memset(pseudo, 0, sizeof(pseudo));
-            return;
-        }
-    }
-
-    Player *player = find_player_by_pseudo(pseudo);
+void handle_see_player_bio(Player *player_target, Command *cmd) {
+    Player *player = find_player(cmd->args[0].ptr, cmd->args[0].len);
     if (player == NULL) {
         send_message(player_target->socket, "Player not found\n");
+        return;
     }
 
-    char bio_output[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH] = "Bio:\n";
+    char bio_output[MAX_BIO_LINES * MAX_BIO_LINE_LENGTH + 8] = "Bio:\n";
 
-    if (strlen(player->bio) > 0) {
-        strcat(bio_output, player->bio);
+    lock_profile(player);
+    bool has_bio = strlen(player->profile->bio) > 0;
+    if (has_bio) {
+        strcat(bio_output, player->profile->bio);
         strcat(bio_output, "\n");
+    }
+    pthread_mutex_unlock(&player->profile->lock);
+
+    if (has_bio) {
         send_message(player_target->socket, bio_output);
     } else {
         send_message(player_target->socket, "The player hasn't added a bio yet.\n");
     }
-    memset(pseudo, 0, sizeof(pseudo));
 }
 
 void send_active_games(Player *player) {
-    pthread_mutex_lock(&player_mutex);
-    char response[BUFFER_SIZE];
+    send_listing(player, LISTING_GAMES);
+}
 
-    strcpy(response, "Active games:\n");
-    for (int i = 0; i < active_game_count; i++) {
-        Game *game = active_games[i];
-        char game_info[MAX_PSEUDO_LEN * 2 + 6];
-        snprintf(game_info, sizeof(game_info), "%s VS %s\n",
-                 game->player1->pseudo,
-                 game->player2->pseudo);
-        strcat(response, game_info);
+// Best TOP_PLAYERS by win count into top, ties kept in registry order, online_only needs registry_mutex
+int select_top_players(Player **top, bool online_only) {
+    int count = 0;
+    int candidates = online_only ? online_set_count : registered_players();
+    for (int i = 0; i < candidates; i++) {
+        Player *entry = online_only ? online_set[i] : player_at(i);
+        if (entry->pseudo[0] == '\0' || entry->win_count < 0) {
+            continue;
+        }
+        if (count == TOP_PLAYERS && entry->win_count <= top[count - 1]->win_count) {
+            continue;
+        }
+        int slot = count < TOP_PLAYERS ? count++ : count - 1;
+        while (slot > 0 && top[slot - 1]->win_count < entry->win_count) {
+            top[slot] = top[slot - 1];
+            slot--;
+        }
+        top[slot] = entry;
     }
-    send_message(player->socket, response);
-
-    memset(response, 0, sizeof(response));
-    pthread_mutex_unlock(&player_mutex);
-
+    return count;
 }
 
 void send_top_online_players(Player *player) {
-    pthread_mutex_lock(&player_mutex);
-    char response[BUFFER_SIZE];
-    char player_info[BUFFER_SIZE];
-
-    strcpy(response, "Top 10 Online Players (by Win Count):\n");
+    send_listing(player, LISTING_TOP_ONLINE);
+}
 
-    // Create an array of player pointers to sort
-    Player *online_players[MAX_PLAYERS];
-    int online_count = 0;
+void send_top_players(Player *player) {
+    send_listing(player, LISTING_TOP);
+}
 
-    // Collect all online players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].is_online) {
-            online_players[online_count++] = &players[i];
-        }
-    }
+// Send list of online players
+void send_online_players(Player *player) {
+    send_listing(player, LISTING_ONLINE);
+}
 
-    // Sort online players based on win count (descending order)
-    for (int i = 0; i < online_count - 1; i++) {
-        for (int j = i + 1; j < online_count; j++) {
-            if (online_players[i]->win_count < online_players[j]->win_count) {
-                // Swap pointers if the player[i] has fewer wins than player[j]
-                Player *temp = online_players[i];
-                online_players[i] = online_players[j];
-                online_players[j] = temp;
+// Serves a listing command from its snapshot, the reply is formatted outside any lock
+void send_listing(Player *player, ListingKind kind) {
+    static const char *titles[LISTING_KINDS] = {
+            [LISTING_ONLINE] = "Online players:\n",
+            [LISTING_PLAYERS] = "All players:\n",
+            [LISTING_GAMES] = "Active games:\n",
+            [LISTING_TOP] = "Top 10 Online Players (by Win Count):\n",
+            [LISTING_TOP_ONLINE] = "Top 10 Online Players (by Win Count):\n"
+    };
+    bool skip_self = kind == LISTING_ONLINE || kind == LISTING_PLAYERS;
+    bool with_wins = kind == LISTING_TOP || kind == LISTING_TOP_ONLINE;
+    int step = kind == LISTING_GAMES ? 2 : 1;
+    // Asked before the read section, which must not block on connections_lock or the out_lock
+    bool binary = connection_is_binary(player->socket);
+    int epoch;
+    Listing *listing = read_listing(kind, &epoch);
+    int count = listing != NULL ? listing->count : 0;
+
+    if (binary) {
+        Frame frame;
+        int sent = 0;
+        frame_init(&frame, MSG_LISTING);
+        frame_put_u8(&frame, kind);
+        frame_put_u16(&frame, 0);  // Patched below
+        for (int i = 0; i + step <= count; i += step) {
+            ListingEntry *entry = &listing->entries[i];
+            if (skip_self && strcmp(entry->pseudo, player->pseudo) == 0) {
+                continue;
+            }
+            int mark = frame.len;
+            bool fits = frame_put_string(&frame, entry->pseudo);
+            if (fits && step == 2) {
+                fits = frame_put_string(&frame, entry[1].pseudo);
+            }
+            if (fits && with_wins) {
+                fits = frame_put_u16(&frame, entry->win_count);
             }
+            if (!fits) {
+                frame.len = mark;
+                break;
+            }
+            sent++;
         }
+        listing_read_end(epoch);
+        frame.data[FRAME_HEADER + 1] = (unsigned char) (sent >> 8);
+        frame.data[FRAME_HEADER + 2] = (unsigned char) sent;
+        send_frame(player->socket, &frame);
+        return;
     }
 
-    // Prepare the response with top 10 players (or fewer if less than 10 online)
-    for (int i = 0; i < online_count && i < 10; i++) {
-        snprintf(player_info, sizeof(player_info), "%s - Wins: %d\n", online_players[i]->pseudo,
-                 online_players[i]->win_count);
-        strcat(response, player_info);
+    char response[BUFFER_SIZE];
+    char line[2 * MAX_PSEUDO_LEN + 32];
+    size_t len = strlen(strcpy(response, titles[kind]));
+    for (int i = 0; i + step <= count; i += step) {
+        ListingEntry *entry = &listing->entries[i];
+        int line_len;
+        if (skip_self && strcmp(entry->pseudo, player->pseudo) == 0) {
+            continue;
+        }
+        if (step == 2) {
+            line_len = sprintf(line, "%s VS %s\n", entry->pseudo, entry[1].pseudo);
+        } else if (with_wins) {
+            line_len = sprintf(line, "%s - Wins: %d\n", entry->pseudo, entry->win_count);
+        } else {
+            line_len = sprintf(line, "%s\n", entry->pseudo);
+        }
+        if (len + line_len + 1 > sizeof(response)) {
+            break;  // The rest does not fit in one reply
+        }
+        memcpy(response + len, line, line_len + 1);
+        len += line_len;
     }
-
-    // Send the response to the player
+    listing_read_end(epoch);
     send_message(player->socket, response);
-
-    // Clear the response buffer for safety
-    memset(response, 0, sizeof(response));
-    pthread_mutex_unlock(&player_mutex);
 }
 
-void send_top_players(Player *player) {
-    pthread_mutex_lock(&player_mutex);
-    char response[BUFFER_SIZE];
-    char player_info[BUFFER_SIZE];
-
-    strcpy(response, "Top 10 Online Players (by Win Count):\n");
-
-    // Create an array of player pointers to sort
-    Player *online_players[MAX_PLAYERS];
-    int online_count = 0;
-
-    // Collect all online players and skip invalid ones
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].pseudo[0] != '\0' && players[i].win_count >= 0) {  // Ensure valid player data
-            online_players[online_count++] = &players[i];
+// Marks the listings in kinds (LISTING_BIT mask) stale, called once the change they show is made
+void invalidate_listings(unsigned kinds) {
+    for (int kind = 0; kind < LISTING_KINDS; kind++) {
+        if (kinds & LISTING_BIT(kind)) {
+            __atomic_add_fetch(&listing_versions[kind], 1, __ATOMIC_RELEASE);
         }
     }
+}
+
+// Copies what a listing shows out of the live state, at most LISTING_BYTES of pseudos, NULL on failure
+Listing *collect_listing(ListingKind kind) {
+    int capacity;
+    Player *top[TOP_PLAYERS];
+
+    if (kind == LISTING_ONLINE || kind == LISTING_TOP_ONLINE) {
+        pthread_mutex_lock(&registry_mutex);
+        capacity = kind == LISTING_ONLINE ? online_set_count : TOP_PLAYERS;
+    } else if (kind == LISTING_GAMES) {
+        pthread_rwlock_rdlock(&games_lock);
+        capacity = 2 * active_game_count;
+    } else {
+        // The registry only grows and published pseudos never change, it is read without locking
+        capacity = kind == LISTING_PLAYERS ? registered_players() : TOP_PLAYERS;
+    }
+    if (capacity > LISTING_BYTES / 2) {
+        capacity = LISTING_BYTES / 2;  // Shortest entry costs two bytes
+    }
+
+    Listing *listing = malloc(sizeof(Listing) + capacity * sizeof(ListingEntry));
+    if (listing != NULL) {
+        int count = 0;
+        int bytes = 0;
+        int candidates = 0;
+        if (kind == LISTING_TOP || kind == LISTING_TOP_ONLINE) {
+            candidates = select_top_players(top, kind == LISTING_TOP_ONLINE);
+        } else if (kind == LISTING_ONLINE) {
+            candidates = online_set_count;
+        } else if (kind == LISTING_PLAYERS) {
+            candidates = registered_players();
+        } else {
+            candidates = game_slot_count;
+        }
 
-    // Sort online players based on win count (descending order)
-    for (int i = 0; i < online_count - 1; i++) {
-        for (int j = i + 1; j < online_count; j++) {
-            if (online_players[i]->win_count < online_players[j]->win_count) {
-                // Swap pointers if the player[i] has fewer wins than player[j]
-                Player *temp = online_players[i];
-                online_players[i] = online_players[j];
-                online_players[j] = temp;
+        for (int i = 0; i < candidates && count < capacity && bytes < LISTING_BYTES; i++) {
+            Player *entries[2];
+            int entry_count = 1;
+            if (kind == LISTING_TOP || kind == LISTING_TOP_ONLINE) {
+                entries[0] = top[i];
+            } else if (kind == LISTING_ONLINE) {
+                entries[0] = online_set[i];
+            } else if (kind == LISTING_PLAYERS) {
+                entries[0] = player_at(i);
+            } else if (game_slots[i].game != NULL && count + 2 <= capacity) {
+                entries[0] = game_slots[i].game->player1;
+                entries[1] = game_slots[i].game->player2;
+                entry_count = 2;
+            } else {
+                continue;
+            }
+            if (entries[0]->pseudo[0] == '\0') {
+                continue;  // Registration still filling the slot
+            }
+            for (int j = 0; j < entry_count; j++) {
+                ListingEntry *entry = &listing->entries[count++];
+                memcpy(entry->pseudo, entries[j]->pseudo, MAX_PSEUDO_LEN);
+                entry->pseudo[MAX_PSEUDO_LEN - 1] = '\0';
+                entry->win_count = entries[j]->win_count;
+                bytes += (int) strlen(entry->pseudo) + 1;
             }
         }
+        listing->count = count;
+    } else {
+        perror("Failed to build listing");
     }
 
-    // Prepare the response with top 10 players (or fewer if less than 10 online)
-    for (int i = 0; i < online_count && i < 10; i++) {
-        snprintf(player_info, sizeof(player_info), "%s - Wins: %d\n", online_players[i]->pseudo,
-                 online_players[i]->win_count);
-        strcat(response, player_info);
+    if (kind == LISTING_ONLINE || kind == LISTING_TOP_ONLINE) {
+        pthread_mutex_unlock(&registry_mutex);
+    } else if (kind == LISTING_GAMES) {
+        pthread_rwlock_unlock(&games_lock);
     }
-
-    // Send the response to the player
-    send_message(player->socket, response);
-
-    // Clear the response buffer for safety
-    memset(response, 0, sizeof(response));
-    pthread_mutex_unlock(&player_mutex);
+    return listing;
 }
 
-// Send list of online players
-void send_online_players(Player *player) {
-    pthread_mutex_lock(&player_mutex);
-    char response[BUFFER_SIZE];
+// Rebuilds a stale snapshot; while one thread rebuilds, the others keep serving the previous one
+void refresh_listing(ListingKind kind) {
+    unsigned long version = __atomic_load_n(&listing_versions[kind], __ATOMIC_ACQUIRE);
+    bool published = __atomic_load_n(&listings[kind], __ATOMIC_ACQUIRE) != NULL;
+    if (published && __atomic_load_n(&listing_built[kind], __ATOMIC_ACQUIRE) == version) {
+        return;
+    }
 
-    strcpy(response, "Online players:\n");
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].is_online) {
-            if (strcmp(players[i].pseudo, player->pseudo) == 0) {
-                continue;
-            }
-            strcat(response, players[i].pseudo);
-            strcat(response, "\n");
-        }
+    if (!published) {
+        pthread_mutex_lock(&listing_build_locks[kind]);  // Nothing to serve yet
+    } else if (pthread_mutex_trylock(&listing_build_locks[kind]) != 0) {
+        return;
     }
-    send_message(player->socket, response);
-    memset(response, 0, sizeof(response));
-    pthread_mutex_unlock(&player_mutex);
-}
 
-bool is_pseudo_taken(const char *pseudo) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (strcmp(players[i].pseudo, pseudo) == 0) {
-            return 1;
+    version = __atomic_load_n(&listing_versions[kind], __ATOMIC_ACQUIRE);
+    if (listings[kind] == NULL || listing_built[kind] != version) {
+        Listing *fresh = collect_listing(kind);
+        if (fresh != NULL) {
+            publish_listing(kind, fresh);
+            __atomic_store_n(&listing_built[kind], version, __ATOMIC_RELEASE);
         }
     }
-    return 0;
+    pthread_mutex_unlock(&listing_build_locks[kind]);
 }
 
-void send_all_players(Player *player) {
-    pthread_mutex_lock(&player_mutex);
-    char response[BUFFER_SIZE];
-
-    strcpy(response, "All players:\n");
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].pseudo[0] != '\0' && strcmp(players[i].pseudo, player->pseudo) != 0) {
-            strcat(response, players[i].pseudo);
-            strcat(response, "\n");
-        }
+// Swaps in a new snapshot and frees the old one once no reader can still hold it
+void publish_listing(ListingKind kind, Listing *fresh) {
+    pthread_mutex_lock(&listing_publish_mutex);
+    Listing *old = __atomic_exchange_n(&listings[kind], fresh, __ATOMIC_SEQ_CST);
 
+    // Readers counted under the new parity loaded the pointer after the exchange, only the old parity can hold old
+    int previous = (int) (__atomic_fetch_add(&listing_epoch, 1, __ATOMIC_SEQ_CST) & 1);
+    while (__atomic_load_n(&listing_readers[previous], __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
     }
-    send_message(player->socket, response);
-    memset(response, 0, sizeof(response));
-    pthread_mutex_unlock(&player_mutex);
+    pthread_mutex_unlock(&listing_publish_mutex);
+    free(old);
 }
 
-
-void save_player_to_file(Player *player) {
-    FILE *file = fopen(PLAYER_FILE, "a");
-    if (file) {
-        fprintf(file, "%s %s %d\n", player->pseudo, player->password, player->private);
-
-        // Write friends to the file
-        fprintf(file, "friends: ");
-        for (int i = 0; i < MAX_FRIENDS && player->friends[i][0] != '\0'; i++) {
-            fprintf(file, "%s ", player->friends[i]);
-        }
-        fprintf(file, "\n");
-
-        // Write bio to the file
-        fprintf(file, "bio:\n");
-        for (int i = 0; i < MAX_BIO_LINES; i++) {
-            if (player->bio[i] != '\0') {
-                fprintf(file, "%s\n", player->bio[i]);
-            }
+// Current snapshot of kind, valid until listing_read_end(*epoch), which must come before any blocking call
+Listing *read_listing(ListingKind kind, int *epoch) {
+    refresh_listing(kind);
+    for (;;) {
+        int parity = (int) (__atomic_load_n(&listing_epoch, __ATOMIC_SEQ_CST) & 1);
+        __atomic_add_fetch(&listing_readers[parity], 1, __ATOMIC_SEQ_CST);
+        if ((int) (__atomic_load_n(&listing_epoch, __ATOMIC_SEQ_CST) & 1) == parity) {
+            *epoch = parity;
+            return __atomic_load_n(&listings[kind], __ATOMIC_SEQ_CST);
         }
-
-        fprintf(file, "-----\n");
-        fclose(file);
-    } else {
-        perror("Failed to open player file");
+        __atomic_sub_fetch(&listing_readers[parity], 1, __ATOMIC_SEQ_CST);  // Flipped meanwhile, join the new one
     }
 }
 
+void listing_read_end(int epoch) {
+    __atomic_sub_fetch(&listing_readers[epoch], 1, __ATOMIC_RELEASE);
+}
 
-void save_bio_to_file(Player *player) {
-    FILE *file = fopen(PLAYER_FILE, "w");
-    if (!file) {
-        perror("Error opening file for writing");
-        return;
+// Connections held by each shard and how often each command ran
+void send_server_stats(Player *player) {
+    char response[BUFFER_SIZE];
+    int len = snprintf(response, sizeof(response), "Shards: %d\n", shard_count);
+
+    for (int i = 0; i < shard_count && len < (int) sizeof(response); i++) {
+        len += snprintf(response + len, sizeof(response) - len, "Shard %d: %d connections\n", i,
+                        __atomic_load_n(&shards[i].connection_count, __ATOMIC_RELAXED));
+    }
+    if (len < (int) sizeof(response)) {
+        static const char *modes[] = {"none", "batched", "every-write"};
+        pthread_mutex_lock(&persist_mutex);
+        len += snprintf(response + len, sizeof(response) - len,
+                        "Persistence (%s): %d queued, peak %d, %lu flushes, last %ld us, max %ld us\n",
+                        modes[durability], persist_depth, persist_peak_depth, persist_flushes,
+                        persist_last_flush_us, persist_max_flush_us);
+        pthread_mutex_unlock(&persist_mutex);
+    }
+    if (len < (int) sizeof(response)) {
+        pthread_rwlock_rdlock(&games_lock);
+        len += snprintf(response + len, sizeof(response) - len, "Games: %d active in %d slots\n", active_game_count,
+                        game_slot_count);
+        pthread_rwlock_unlock(&games_lock);
+    }
+    Pool *pools[2 + OBSERVER_CLASSES] = {&game_pool, &move_log_pool};
+    for (int i = 0; i < OBSERVER_CLASSES; i++) {
+        pools[2 + i] = &observer_pools[i];
+    }
+    for (int i = 0; i < 2 + OBSERVER_CLASSES && len < (int) sizeof(response); i++) {
+        Pool *pool = pools[i];
+        pthread_mutex_lock(&pool->lock);
+        if (pool->slabs > 0) {
+            len += snprintf(response + len, sizeof(response) - len,
+                            "Pool %s: %d in use, peak %d, %d blocks of %zu bytes in %d slabs\n", pool->name,
+                            pool->in_use, pool->peak, pool->blocks, pool->block_size, pool->slabs);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    for (int i = 0; i < COMMAND_COUNT && len < (int) sizeof(response); i++) {
+        unsigned long calls = __atomic_load_n(&commands[i].calls, __ATOMIC_RELAXED);
+        if (calls > 0) {
+            len += snprintf(response + len, sizeof(response) - len, "%s: %lu calls\n", commands[i].name, calls);
+        }
     }
+    send_message(player->socket, response);
+}
 
-    // Write all players to the file
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].pseudo[0] != '\0') {  // Check if player slot is not empty
-            fprintf(file, "%s %s\n", players[i].pseudo, players[i].password);
+bool is_pseudo_taken(const char *pseudo) {
+    return find_player_by_pseudo(pseudo) != NULL;
+}
 
-            fprintf(file, "friends: ");
-            for (int i = 0; i < MAX_FRIENDS && player->friends[i][0] != '\0'; i++) {
-                fprintf(file, "%s ", player->friends[i]);
-            }
-            fprintf(file, "\n");
-            // Write the bio, ensuring the "bio:" label
-            fprintf(file, "bio:\n%s\n", players[i].bio);
+void send_all_players(Player *player) {
+    send_listing(player, LISTING_PLAYERS);
+}
 
-            // Write the "-----" separator after each player's data
-            fprintf(file, "-----\n");
-        }
-    }
 
-    fclose(file);
-    printf("Players file updates.\n");
+// New account as a journal record
+void save_player_to_file(Player *player) {
+    journal_player_change("REGISTER %s %s %d", player->pseudo, player->profile->password, player->private);
 }
 
+
 Player *handle_login(char *pseudo, char *password, int client_socket) {
-    pthread_mutex_lock(&player_mutex);  // Locking the mutex to ensure thread-safety
+    pthread_mutex_lock(&registry_mutex);  // Locking the mutex to ensure thread-safety
     Player *player = find_player_by_pseudo(pseudo);
     if (player == NULL) {
-        send_message(client_socket, "Player not found!\n");
-        pthread_mutex_unlock(&player_mutex);
-        answer(client_socket);
+        pthread_mutex_unlock(&registry_mutex);
+        send_auth_status(client_socket, AUTH_NOT_FOUND, "Player not found!");
         return NULL;
     } else {
         if (player->is_online) {
             // If the player is already online
-            send_message(client_socket, "You are already logged in!\n");
-            pthread_mutex_unlock(&player_mutex);  // Unlock mutex before returning
-            answer(client_socket);
+            pthread_mutex_unlock(&registry_mutex);  // Unlock mutex before returning
+            send_auth_status(client_socket, AUTH_CONFLICT, "You are already logged in!");
+            return NULL;
+        }
+
+        bool password_matches = strcmp(lock_profile(player)->password, password) == 0;
+        pthread_mutex_unlock(&player->profile->lock);
+        if (!password_matches) {
+            pthread_mutex_unlock(&registry_mutex);  // Unlock mutex before returning
+            send_auth_status(client_socket, AUTH_BAD_PASSWORD, "Incorrect password!");
             return NULL;
         }
 
-        if (strcmp(player->password, password) != 0) {
-            send_message(client_socket, "Incorrect password!\n");
-            pthread_mutex_unlock(&player_mutex);  // Unlock mutex before returning
-            answer(client_socket);
+        if (!add_online_player(player)) {
+            pthread_mutex_unlock(&registry_mutex);
+            send_auth_status(client_socket, AUTH_SERVER_FULL, "Server full!");
             return NULL;
         }
 
@@ -1118,12 +3893,11 @@ Player *handle_login(char *pseudo, char *password, int client_socket) {
         player->is_online = true;
         player->socket = client_socket;
 
-        send_message(client_socket, "Login successful!\n");
-        answer(client_socket);
+        send_auth_status(client_socket, AUTH_LOGGED_IN, "Login successful!");
         printf("Player logged in: %s\n", pseudo);
 
 
-        pthread_mutex_unlock(&player_mutex);  // Unlock mutex after handling the login
+        pthread_mutex_unlock(&registry_mutex);  // Unlock mutex after handling the login
         return player;
     }
 
@@ -1131,54 +3905,55 @@ Player *handle_login(char *pseudo, char *password, int client_socket) {
 
 Player *handle_registration(char *pseudo, char *password, int client_socket) {
     if (strlen(pseudo) == 0 || strlen(password) == 0) {
-        send_message(client_socket, "Pseudo and password cannot be empty!\n");
-        answer(client_socket);
+        send_auth_status(client_socket, AUTH_BAD_REQUEST, "Pseudo and password cannot be empty!");
         return NULL;
     }
 
-    pthread_mutex_lock(&player_mutex);
+    pthread_mutex_lock(&registry_mutex);
 
     if (is_pseudo_taken(pseudo)) {
-        send_message(client_socket, "Pseudo already taken!\n");
-        answer(client_socket);
+        pthread_mutex_unlock(&registry_mutex);
+        send_auth_status(client_socket, AUTH_CONFLICT, "Pseudo already taken!");
         return NULL;
     }
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].is_online && strcmp(players[i].pseudo, pseudo) == 0) {
-            send_message(client_socket, "Pseudo already taken!\n");
-            answer(client_socket);
-            return NULL;
-        }
+    Player *player = allocate_player();
+    if (player == NULL) {
+        pthread_mutex_unlock(&registry_mutex);
+        send_auth_status(client_socket, AUTH_SERVER_FULL, "Server full!");
+        return NULL;
     }
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (!players[i].is_online && players[i].pseudo[0] == '\0') {
-            strcpy(players[i].pseudo, pseudo);
-            strcpy(players[i].password, password);
-            players[i].socket = client_socket;
-            players[i].is_online = true;
-            players[i].private = false;
+    // A compaction running meanwhile sees the slot either blank or complete
+    lock_profile(player);
+    strcpy(player->pseudo, pseudo);
+    strcpy(player->profile->password, password);
+    pthread_mutex_unlock(&player->profile->lock);
+    player_index_insert(player);
+    invalidate_listings(LISTING_BIT(LISTING_PLAYERS) | LISTING_BIT(LISTING_TOP));
+    player->socket = client_socket;
+    player->is_online = true;
+    player->private = false;
 
-            players[i].challenged_by[0] = '\0';
-            players[i].challenged[0] = '\0';
-            players[i].observing[0] = '\0';
-            players[i].game_id = -1;
-
-            save_player_to_file(&players[i]); // Save to file
-            send_message(client_socket, "Registration successful!\n");
-            printf("Player registered: %s\n", pseudo);
+    player->challenged_by[0] = '\0';
+    player->challenged[0] = '\0';
+    player->observing = NO_GAME;
 
-            pthread_mutex_unlock(&player_mutex);
-            answer(client_socket);
-            return &players[i];
-        }
+    bool online = add_online_player(player);
+    if (!online) {
+        player->is_online = false;
+        player->socket = -1;
     }
+    pthread_mutex_unlock(&registry_mutex);
 
-    send_message(client_socket, "Server full!\n");
-    answer(client_socket);
-    pthread_mutex_unlock(&player_mutex);
-    return NULL;
+    save_player_to_file(player); // Save to file, outside registry_mutex since it may wait for the disk
+    if (!online) {
+        send_auth_status(client_socket, AUTH_SERVER_FULL, "Server full!");
+        return NULL;
+    }
+    send_auth_status(client_socket, AUTH_REGISTERED, "Registration successful!");
+    printf("Player registered: %s\n", pseudo);
+    return player;
 }
 
 
@@ -1186,11 +3961,17 @@ void handle_logout(Player *player) {
     send_message(player->socket, "Logging out...\n");
     printf("Logging out: %s\n", player->pseudo);
 
-    if (player->game_id != -1) {
-        remove_game(player->game_id);
+    GameHandle handles[MAX_PLAYER_GAMES];
+    int count = player_games(player, handles);
+    for (int i = 0; i < count; i++) {
+        Game *game = acquire_game(handles[i]);
+        if (game != NULL) {
+            finish_game(game);
+            release_game(game);
+        }
     }
-    pthread_mutex_lock(&player_mutex);
 
+    pthread_mutex_lock(&challenge_mutex);
     if (player->challenged_by[0] != '\0') {
         Player *challenged_by_player = find_player_by_pseudo(player->challenged_by);
         if (challenged_by_player != NULL) {
@@ -1206,42 +3987,45 @@ void handle_logout(Player *player) {
         }
         player->challenged[0] = '\0';
     }
+    pthread_mutex_unlock(&challenge_mutex);
 
-    if (player->observing[0] != '\0') {
+    if (__atomic_load_n(&player->observing, __ATOMIC_RELAXED) != NO_GAME) {
         remove_observer(player);
     }
 
+    // The connection owner notices the detached socket and closes it
+    pthread_mutex_lock(&registry_mutex);
+    remove_online_player(player);
     player->is_online = false;
     player->socket = -1;
-
+    pthread_mutex_unlock(&registry_mutex);
 
     printf("Player logged out: %s\n", player->pseudo);
-
-    close(player->socket);
-    pthread_mutex_unlock(&player_mutex);
-    pthread_exit(NULL);
 }
 
 
 void initialize_game(Player *player1, Player *player2) {
-    Game *new_game = malloc(sizeof(Game));
-    int id = add_game(new_game);
-    if (id == -1) {
-        send_message(player1->socket, "Failed to start the game. Server capacity reached.\n");
-        send_message(player2->socket, "Failed to start the game. Server capacity reached.\n");
-        free(new_game);
+    Game *new_game = pool_alloc(&game_pool);
+    if (new_game == NULL) {
+        perror("Failed to allocate game");
         return;
     }
-
-    pthread_mutex_lock(&player_mutex);
+    new_game->observers = NULL;  // Taken from a pool by the first observer
     new_game->observer_count = 0;
+    new_game->observer_capacity = 0;
     // Assign players to the game
     new_game->player1 = player1;
     new_game->player2 = player2;
     new_game->save_on_exit = false;
-    player1->game_id = id;
-    player2->game_id = id;
-    pthread_mutex_unlock(&player_mutex);
+    new_game->started = time(NULL);
+    new_game->moves = NULL;  // Taken from move_log_pool by the first move
+    new_game->move_count = 0;
+    new_game->move_capacity = 0;
+    pthread_mutex_init(&new_game->lock, NULL);
+    new_game->refs = 2;  // Held by the table, and by this function until the players are told
+    new_game->finished = false;
+    new_game->unlinked = false;
+    new_game->persist_sequence = 0;
 
     // Initialize pits for both players
     initialize_board(new_game);
@@ -1255,29 +4039,26 @@ void initialize_game(Player *player1, Player *player2) {
     } else {
         strcpy(new_game->current_turn, player2->pseudo);
     }
-    send_game_start_message(player1->socket, player2->socket, turn);
-    send_boards_players(new_game->player1, new_game->player2);
-}
-
-void clean_player_game_state(Player *player) {
-    player->game_id = -1;
-    player->store = 0;
-    memset(player->pits, 0, sizeof(player->pits));
 
-    Move *current_move = player->move_history;
-    while (current_move != NULL) {
-        Move *next_move = current_move->next;
-        free(current_move);
-        current_move = next_move;
+    // Locked before it is published, so the players' commands wait until they know the game started
+    pthread_mutex_lock(&new_game->lock);
+    if (add_game(new_game) == NO_GAME) {
+        pthread_mutex_unlock(&new_game->lock);
+        send_message(player1->socket, "Failed to start the game. Server capacity reached.\n");
+        send_message(player2->socket, "Failed to start the game. Server capacity reached.\n");
+        free_game(new_game);
+        return;
     }
-    player->move_history = NULL; // Ensure the pointer is reset
+
+    send_game_start_message(player1->socket, player2->socket, turn);
+    send_board(player1->socket, new_game, 0);
+    send_board(player2->socket, new_game, 1);
+    release_game(new_game);
 }
 
 void clean_up_game(Game *game) {
     send_message(game->player1->socket, "Game finished\n");
     send_message(game->player2->socket, "Game finished\n");
-    clean_player_game_state(game->player1);
-    clean_player_game_state(game->player2);
 }
 
 
@@ -1291,51 +4072,296 @@ void send_game_start_message(int client_socket, int challenged_socket, int turn)
     }
 }
 
+// Caller holds game->lock, or the game is not published yet
 void initialize_board(Game *game) {
-    pthread_mutex_lock(&player_mutex);
-    for (int i = 0; i < PITS; i++) {
-        game->player1->pits[i] = INITIAL_SEEDS;
-        game->player2->pits[i] = INITIAL_SEEDS;
-    }
-    game->player1->store = 0;
-    game->player2->store = 0;
-    pthread_mutex_unlock(&player_mutex);
+    memset(game->state.pit, 0, sizeof(game->state.pit));
+    memset(game->state.pit, INITIAL_SEEDS, BOARD_PITS);
 }
 
 
-int add_game(Game *new_game) {
-    pthread_mutex_lock(&player_mutex);
+// Publishes the game in a free slot, growing the table when there is none, and adds it to both players' games.
+// NO_GAME if that fails or either player has MAX_PLAYER_GAMES going already.
+GameHandle add_game(Game *new_game) {
+    pthread_rwlock_wrlock(&games_lock);
+    if (new_game->player1->game_count >= MAX_PLAYER_GAMES || new_game->player2->game_count >= MAX_PLAYER_GAMES) {
+        pthread_rwlock_unlock(&games_lock);
+        return NO_GAME;
+    }
+
+    if (game_free_slot == -1) {
+        int count = game_slot_count > 0 ? 2 * game_slot_count : GAME_TABLE_INITIAL;
+        GameSlot *slots = realloc(game_slots, count * sizeof(GameSlot));
+        if (slots == NULL) {
+            pthread_rwlock_unlock(&games_lock);
+            return NO_GAME;
+        }
+        for (int i = count - 1; i >= game_slot_count; i--) {
+            slots[i].game = NULL;
+            slots[i].generation = 1;
+            slots[i].next_free = game_free_slot;
+            game_free_slot = i;
+        }
+        game_slots = slots;
+        game_slot_count = count;
+    }
 
-    if (active_game_count >= MAX_GAMES) {
-        return -1; // Cannot add more games, array is full
+    int slot = game_free_slot;
+    new_game->handle = (GameHandle) game_slots[slot].generation << 32 | (uint32_t) slot;
+    if (!add_membership(new_game->player1, new_game->handle)) {
+        pthread_rwlock_unlock(&games_lock);
+        return NO_GAME;
     }
+    if (!add_membership(new_game->player2, new_game->handle)) {
+        remove_membership(new_game->player1, new_game->handle);
+        pthread_rwlock_unlock(&games_lock);
+        return NO_GAME;
+    }
+    game_free_slot = game_slots[slot].next_free;
+    game_slots[slot].game = new_game;
+    active_game_count++;
+    invalidate_listings(LISTING_BIT(LISTING_GAMES));
 
-    active_games[active_game_count++] = new_game;
-    pthread_mutex_unlock(&player_mutex);
-    return active_game_count - 1;
+    pthread_rwlock_unlock(&games_lock);
+    return new_game->handle;
 }
 
-void remove_game(int game_id) {
-    pthread_mutex_lock(&player_mutex);
-    for (int i = 0; i < active_game_count; i++) {
-        if (i == game_id) {
-            // Shift all games after the found game to fill the gap
-            clean_up_game(active_games[game_id]);
-            free(active_games[game_id]);
-            for (int j = i; j < active_game_count - 1; j++) {
-                active_games[j + 1]->player1->game_id = j;
-                active_games[j + 1]->player2->game_id = j;
-                active_games[j] = active_games[j + 1];
-            }
-            active_game_count--;
+// Pins and locks the game a handle names, NULL if it is gone or already finished
+Game *acquire_game(GameHandle handle) {
+    pthread_rwlock_rdlock(&games_lock);
+    Game *game = NULL;
+    uint32_t slot = GAME_SLOT(handle);
+    if (slot < (uint32_t) game_slot_count && game_slots[slot].generation == GAME_GENERATION(handle)) {
+        game = game_slots[slot].game;
+    }
+    if (game != NULL) {
+        __atomic_add_fetch(&game->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&games_lock);
+
+    if (game == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&game->lock);
+    if (game->finished) {
+        release_game(game);
+        return NULL;
+    }
+    return game;
+}
+
+// Appends to the player's games, which becomes the current one if there was none. Caller holds games_lock
+// for writing.
+bool add_membership(Player *player, GameHandle handle) {
+    if (player->game_count == player->game_capacity) {
+        int capacity = player->game_capacity > 0 ? 2 * player->game_capacity : 4;
+        GameHandle *games = realloc(player->games, capacity * sizeof(GameHandle));
+        if (games == NULL) {
+            return false;
+        }
+        player->games = games;
+        player->game_capacity = capacity;
+    }
+    player->games[player->game_count] = handle;
+    __atomic_store_n(&player->game_count, player->game_count + 1, __ATOMIC_RELAXED);
+    if (player->current_game == NO_GAME) {
+        __atomic_store_n(&player->current_game, handle, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+// Drops a game from the player's games, the most recent remaining one becomes current if it was. Caller holds
+// games_lock for writing.
+void remove_membership(Player *player, GameHandle handle) {
+    for (int i = 0; i < player->game_count; i++) {
+        if (player->games[i] == handle) {
+            memmove(&player->games[i], &player->games[i + 1], (player->game_count - i - 1) * sizeof(GameHandle));
+            __atomic_store_n(&player->game_count, player->game_count - 1, __ATOMIC_RELAXED);
             break;
         }
     }
-    pthread_mutex_unlock(&player_mutex);
+    if (player->current_game == handle) {
+        GameHandle next = player->game_count > 0 ? player->games[player->game_count - 1] : NO_GAME;
+        __atomic_store_n(&player->current_game, next, __ATOMIC_RELAXED);
+    }
+}
+
+// Copies the handles of the player's games, at most MAX_PLAYER_GAMES
+int player_games(Player *player, GameHandle *handles) {
+    pthread_rwlock_rdlock(&games_lock);
+    int count = player->game_count;
+    if (count > 0) {
+        memcpy(handles, player->games, count * sizeof(GameHandle));
+    }
+    pthread_rwlock_unlock(&games_lock);
+    return count;
+}
+
+// Handle of the player's game against the named opponent, NO_GAME if they have none. Caller holds games_lock.
+GameHandle find_game_against(Player *player, Slice opponent) {
+    for (int i = 0; i < player->game_count; i++) {
+        Game *game = game_slots[GAME_SLOT(player->games[i])].game;
+        Player *other = game->player1 == player ? game->player2 : game->player1;
+        if (slice_equals(opponent, other->pseudo)) {
+            return player->games[i];
+        }
+    }
+    return NO_GAME;
+}
+
+// The player's game against the named opponent, pinned and locked, NULL if they have none
+Game *acquire_game_against(Player *player, Slice opponent) {
+    pthread_rwlock_rdlock(&games_lock);
+    GameHandle handle = find_game_against(player, opponent);
+    pthread_rwlock_unlock(&games_lock);
+    return acquire_game(handle);
+}
+
+// The player's current_game is only a hint until the game is locked and seen to hold the player
+Game *acquire_player_game(Player *player) {
+    Game *game = acquire_game(__atomic_load_n(&player->current_game, __ATOMIC_RELAXED));
+    if (game != NULL && game->player1 != player && game->player2 != player) {
+        release_game(game);
+        return NULL;
+    }
+    return game;
+}
+
+// Unlocks and unpins; whoever releases a finished game first also takes it out of the table
+void release_game(Game *game) {
+    bool unlink = game->finished && !game->unlinked;
+    if (unlink) {
+        game->unlinked = true;
+    }
+    // A game that ended queued its records; they are waited for once the lock is dropped
+    unsigned long persist_sequence = game->persist_sequence;
+    game->persist_sequence = 0;
+    pthread_mutex_unlock(&game->lock);
+
+    int drop = 1;
+    if (unlink) {
+        pthread_rwlock_wrlock(&games_lock);
+        GameSlot *slot = &game_slots[GAME_SLOT(game->handle)];
+        slot->game = NULL;
+        if (++slot->generation == 0) {
+            slot->generation = 1;
+        }
+        slot->next_free = game_free_slot;
+        game_free_slot = GAME_SLOT(game->handle);
+        remove_membership(game->player1, game->handle);
+        remove_membership(game->player2, game->handle);
+        active_game_count--;
+        invalidate_listings(LISTING_BIT(LISTING_GAMES));
+        pthread_rwlock_unlock(&games_lock);
+        drop++;  // The table's reference
+    }
+
+    if (__atomic_sub_fetch(&game->refs, drop, __ATOMIC_ACQ_REL) == 0) {
+        free_game(game);
+    }
+    wait_for_disk(persist_sequence);
+}
+
+// Returns the game and everything attached to it to their pools, once nobody references it
+void free_game(Game *game) {
+    pthread_mutex_destroy(&game->lock);
+    if (game->move_capacity == MOVE_LOG_INITIAL) {
+        pool_free(&move_log_pool, game->moves);
+    } else {
+        free(game->moves);
+    }
+    for (int i = 0; i < OBSERVER_CLASSES; i++) {
+        if (game->observers != NULL && observer_pools[i].block_size == game->observer_capacity * sizeof(Player *)) {
+            pool_free(&observer_pools[i], game->observers);
+        }
+    }
+    pool_free(&game_pool, game);
+}
+
+void *pool_alloc(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_list == NULL) {
+        // Blocks hold the free list link and stay aligned for any field
+        size_t size = (pool->block_size + 15) & ~(size_t) 15;
+        char *slab = malloc(size * pool->blocks_per_slab);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        for (int i = pool->blocks_per_slab - 1; i >= 0; i--) {
+            *(void **) (slab + i * size) = pool->free_list;
+            pool->free_list = slab + i * size;
+        }
+        pool->blocks += pool->blocks_per_slab;
+        pool->slabs++;
+    }
+    void *block = pool->free_list;
+    pool->free_list = *(void **) block;
+    if (++pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return block;
+}
+
+void pool_free(Pool *pool, void *block) {
+    if (block == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    *(void **) block = pool->free_list;
+    pool->free_list = block;
+    pool->in_use--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Makes room for one more observer, moving the array up a size class when full. Caller holds game->lock.
+bool reserve_observer(Game *game) {
+    if (game->observer_count < game->observer_capacity) {
+        return true;
+    }
+    int from = -1;
+    for (int i = 0; i < OBSERVER_CLASSES; i++) {
+        if (game->observers != NULL && observer_pools[i].block_size == game->observer_capacity * sizeof(Player *)) {
+            from = i;
+        }
+    }
+    if (from == OBSERVER_CLASSES - 1) {
+        return false;
+    }
+    Pool *pool = &observer_pools[from + 1];
+    Player **observers = pool_alloc(pool);
+    if (observers == NULL) {
+        return false;
+    }
+    if (game->observer_count > 0) {
+        memcpy(observers, game->observers, game->observer_count * sizeof(Player *));
+    }
+    if (from >= 0) {
+        pool_free(&observer_pools[from], game->observers);
+    }
+    game->observers = observers;
+    game->observer_capacity = (int) (pool->block_size / sizeof(Player *));
+    return true;
+}
+
+// Ends the game for everyone, caller holds game->lock and releases it afterwards
+void finish_game(Game *game) {
+    game->finished = true;
+    clean_up_game(game);
+
+    for (int i = 0; i < game->observer_count; i++) {
+        Player *observer = game->observers[i];
+        if (__atomic_load_n(&observer->observing, __ATOMIC_RELAXED) == game->handle) {
+            __atomic_store_n(&observer->observing, NO_GAME, __ATOMIC_RELAXED);
+        }
+    }
+    game->observer_count = 0;
 }
 
 void decline_challenge(Player *player) {
+    pthread_mutex_lock(&challenge_mutex);
     if (player->challenged_by[0] == '\0') {
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "You do not have a pending challenge!\n");
         return;
     }
@@ -1343,21 +4369,23 @@ void decline_challenge(Player *player) {
     Player *challenger = find_player_by_pseudo(player->challenged_by);
     if (challenger == NULL || !challenger->is_online) {
         player->challenged_by[0] = '\0';
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "User is not online anymore!\n");
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
     player->challenged_by[0] = '\0';
     challenger->challenged[0] = '\0';
-    pthread_mutex_unlock(&player_mutex);
+    pthread_mutex_unlock(&challenge_mutex);
 
     send_message(challenger->socket, "Your challenge has been declined.\n");
     send_message(player->socket, "You declined the challenge.\n");
 }
 
 void accept_challenge(Player *player) {
+    pthread_mutex_lock(&challenge_mutex);
     if (player->challenged_by[0] == '\0') {
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "You do not have a pending challenge!\n");
         return;
     }
@@ -1365,18 +4393,19 @@ void accept_challenge(Player *player) {
     Player *challenger = find_player_by_pseudo(player->challenged_by);
     if (challenger == NULL || !challenger->is_online) {
         player->challenged_by[0] = '\0';
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "User is not online anymore!\n");
         return;
     }
 
-    if (player->observing[0] != '\0') {
-        player->observing[0] = '\0';
-    }
-
-    pthread_mutex_lock(&player_mutex);
     player->challenged_by[0] = '\0';
     challenger->challenged[0] = '\0';
-    pthread_mutex_unlock(&player_mutex);
+    pthread_mutex_unlock(&challenge_mutex);
+
+    // Players stop observing once they play, the observed game must not keep notifying them
+    if (__atomic_load_n(&player->observing, __ATOMIC_RELAXED) != NO_GAME) {
+        detach_observer(player);
+    }
 
     send_message(player->socket, "You accepted the challenge!\n");
     send_message(challenger->socket, "Your challenge has been accepted!\n");
@@ -1390,39 +4419,68 @@ void notify_move(const char *player_pseudo, int pit_index, Game *game) {
 
     // Compose the message
     snprintf(message, sizeof(message), "%s chose pit %d\n", player_pseudo, pit_index + 1);
+    Frame frame;
+    frame_init(&frame, MSG_MOVE);
+    frame_put_u8(&frame, pit_index + 1);
+    frame_put_string(&frame, player_pseudo);
 
     if (strcmp(game->player1->pseudo, player_pseudo) == 0) {
-        send_message(game->player2->socket, message);
+        send_move_notice(game->player2->socket, message, &frame);
     } else {
-        send_message(game->player1->socket, message);
+        send_move_notice(game->player1->socket, message, &frame);
     }
 
     for (int i = 0; i < game->observer_count; i++) {
-        send_message(game->observers[i]->socket, message);
+        send_move_notice(game->observers[i]->socket, message, &frame);
     }
     memset(message, 0, sizeof(message));
 }
 
 
-void send_boards_players(Player *current, Player *opponent) {
-    send_board(current->socket, current, opponent);
-    send_board(opponent->socket, opponent, current);
+void send_move_notice(int socket, const char *message, Frame *frame) {
+    if (connection_is_binary(socket)) {
+        send_frame(socket, frame);
+    } else {
+        send_message(socket, message);
+    }
 }
 
 void send_boards(Game *game) {
-    send_board(game->player1->socket, game->player1, game->player2);
-    send_board(game->player2->socket, game->player2, game->player1);
+    send_board(game->player1->socket, game, 0);
+    send_board(game->player2->socket, game, 1);
 
     for (int i = 0; i < game->observer_count; i++) {
         if (game->observers[i]->socket > 0) { // Ensure valid socket
-            send_board(game->observers[i]->socket, game->player1, game->player2);
+            send_board(game->observers[i]->socket, game, 0);
         }
     }
 }
 
 
-void send_board(int socket, Player *player1, Player *player2) {
+// Shows the board from side's point of view, its pits at the bottom. Caller holds game->lock.
+void send_board(int socket, Game *game, int side) {
     char board[BUFFER_SIZE];
+    const uint8_t *near = &game->state.pit[side * PITS];
+    const uint8_t *far = &game->state.pit[(1 - side) * PITS];
+    int near_store = game->state.pit[BOARD_STORE(side)];
+    int far_store = game->state.pit[BOARD_STORE(1 - side)];
+    Player *near_player = side == 0 ? game->player1 : game->player2;
+    Player *far_player = side == 0 ? game->player2 : game->player1;
+
+    if (connection_is_binary(socket)) {
+        Frame frame;
+        frame_init(&frame, MSG_BOARD);
+        for (int i = 0; i < PITS; i++) {
+            frame_put_u8(&frame, near[i]);
+        }
+        frame_put_u8(&frame, near_store);
+        for (int i = 0; i < PITS; i++) {
+            frame_put_u8(&frame, far[i]);
+        }
+        frame_put_u8(&frame, far_store);
+        send_frame(socket, &frame);
+        return;
+    }
 
 // Send board to client
     snprintf(board, sizeof(board),
@@ -1433,14 +4491,12 @@ void send_board(int socket, Player *player1, Player *player2) {
              "      +----+----+----+----+----+----+\n"
              "      | %2d | %2d | %2d | %2d | %2d | %2d |Store: %2d\n"
              "      +----+----+----+----+----+----+ %s\n",
-             player2->pseudo,
-             player2->pits[5], player2->pits[4], player2->pits[3], player2->pits[2], player2->pits[1],
-             player2->pits[0],
-             player2->store,
-             player1->pits[0], player1->pits[1], player1->pits[2], player1->pits[3], player1->pits[4],
-             player1->pits[5],
-             player1->store,
-             player1->pseudo
+             far_player->pseudo,
+             far[5], far[4], far[3], far[2], far[1], far[0],
+             far_store,
+             near[0], near[1], near[2], near[3], near[4], near[5],
+             near_store,
+             near_player->pseudo
     );
 
     send_message(socket, board);
@@ -1448,19 +4504,22 @@ void send_board(int socket, Player *player1, Player *player2) {
 }
 
 bool in_friend_list(Player *player, Player *target) {
-    for (int i = 0; i < target->friend_count; i++) {
-        if (strcmp(player->pseudo, target->friends[i]) == 0) {
-            return 1;  // Player is in the friend list, they can observe
+    bool found = false;
+    lock_profile(target);
+    for (int i = 0; i < target->profile->friend_count; i++) {
+        if (strcmp(player->pseudo, target->profile->friends[i]) == 0) {
+            found = true;  // Player is in the friend list, they can observe
+            break;
         }
     }
+    pthread_mutex_unlock(&target->profile->lock);
 
-    return 0;
+    return found;
 }
 
 
-bool can_observe(Player *player, int game_id) {
-    Game *game = active_games[game_id];
-
+// Caller holds game->lock
+bool can_observe(Player *player, Game *game) {
     if (game->player1->private || game->player2->private) {
         return in_friend_list(player, game->player1) || in_friend_list(player, game->player2);
     }
@@ -1468,68 +4527,69 @@ bool can_observe(Player *player, int game_id) {
     return 1;
 }
 
-void update_observers(int game_id) {
-    Game *game = active_games[game_id];
-    if (game == NULL) {
-        pthread_mutex_unlock(&player_mutex);
-        return;
-    }
-
-    if (game->observer_count == 0) {
-        pthread_mutex_unlock(&player_mutex);
-        return;
-    }
+// Drops the observers the player's games no longer admit, after the player went private
+void update_observers(Player *player) {
+    GameHandle handles[MAX_PLAYER_GAMES];
+    int count = player_games(player, handles);
+    for (int g = 0; g < count; g++) {
+        Game *game = acquire_game(handles[g]);
+        if (game == NULL) {
+            continue;
+        }
 
-    for (int i = 0; i < game->observer_count; ++i) {
-        Player *obs = game->observers[i];
-        if (!can_observe(obs, game_id)) {
-            send_message(obs->socket, "One or both players is/are in private mode, only friends can observe\n");
-            remove_observer(obs);
+        for (int i = game->observer_count - 1; i >= 0; i--) {
+            Player *obs = game->observers[i];
+            if (!can_observe(obs, game)) {
+                send_message(obs->socket, "One or both players is/are in private mode, only friends can observe\n");
+                for (int j = i; j < game->observer_count - 1; j++) {
+                    game->observers[j] = game->observers[j + 1];
+                }
+                game->observers[--game->observer_count] = NULL;
+                __atomic_store_n(&obs->observing, NO_GAME, __ATOMIC_RELAXED);
+                send_message(obs->socket, "You have been removed from observing the game\n");
+            }
         }
+        release_game(game);
     }
-
 }
 
 void add_observer(Player *observer, Player *to_observe) {
-    pthread_mutex_lock(&player_mutex);
-    Game *game = active_games[to_observe->game_id];
+    Game *game = acquire_player_game(to_observe);
 
     if (game == NULL) {
         send_message(observer->socket, "Error finding the game...\n");
-        pthread_mutex_unlock(&player_mutex);
         return;
     }
 
-    if (game->observer_count >= MAX_PLAYERS) {
+    if (!can_observe(observer, game)) {
+        release_game(game);
+        send_message(observer->socket, "One or both players is/are in private mode, only friends can observe\n");
+        return;
+    }
+
+    if (game->observer_count >= MAX_OBSERVERS || !reserve_observer(game)) {
+        release_game(game);
         send_message(observer->socket, "Observer limit reached for this game\n");
-        pthread_mutex_unlock(&player_mutex);
         return;
     }
 
-    strcpy(observer->observing, to_observe->pseudo);
+    __atomic_store_n(&observer->observing, game->handle, __ATOMIC_RELAXED);
     game->observers[game->observer_count] = observer;
     game->observer_count++;
-    send_message(observer->socket, "Now you are observing the game\n");
+    release_game(game);
 
-    pthread_mutex_unlock(&player_mutex);
+    send_message(observer->socket, "Now you are observing the game\n");
 }
 
 void remove_observer(Player *observer) {
-    Player *player = find_player_by_pseudo(observer->observing);
-    if (player == NULL) {
-        send_message(observer->socket, "Error finding the game...\n");
-        return;
-    }
-
-    Game *game = active_games[player->game_id];
+    Game *game = acquire_game(__atomic_load_n(&observer->observing, __ATOMIC_RELAXED));
 
     if (game == NULL) {
+        __atomic_store_n(&observer->observing, NO_GAME, __ATOMIC_RELAXED);
         send_message(observer->socket, "Error finding the game...\n");
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
-
     int observer_index = -1;
     for (int i = 0; i < game->observer_count; i++) {
         if (game->observers[i] == observer) {
@@ -1539,6 +4599,8 @@ void remove_observer(Player *observer) {
     }
 
     if (observer_index == -1) {
+        __atomic_store_n(&observer->observing, NO_GAME, __ATOMIC_RELAXED);
+        release_game(game);
         send_message(observer->socket, "You are not observing this game\n");
         return;
     }
@@ -1549,13 +4611,37 @@ void remove_observer(Player *observer) {
 
     game->observers[game->observer_count - 1] = NULL; // Clear the last entry
     game->observer_count--;
+    __atomic_store_n(&observer->observing, NO_GAME, __ATOMIC_RELAXED);
+    release_game(game);
 
     send_message(observer->socket, "You have been removed from observing the game\n");
-    pthread_mutex_unlock(&player_mutex);
+}
+
+// Silent variant of remove_observer, false if the observer was not in the game any more
+bool detach_observer(Player *observer) {
+    Game *game = acquire_game(__atomic_load_n(&observer->observing, __ATOMIC_RELAXED));
+    bool found = false;
+
+    if (game != NULL) {
+        for (int i = 0; i < game->observer_count; i++) {
+            if (game->observers[i] == observer) {
+                found = true;
+            }
+            if (found && i + 1 < game->observer_count) {
+                game->observers[i] = game->observers[i + 1];
+            }
+        }
+        if (found) {
+            game->observers[--game->observer_count] = NULL;
+        }
+        release_game(game);
+    }
+    __atomic_store_n(&observer->observing, NO_GAME, __ATOMIC_RELAXED);
+    return found;
 }
 
 void handle_quit_observe(Player *player) {
-    if (player->observing[0] == '\0') {
+    if (__atomic_load_n(&player->observing, __ATOMIC_RELAXED) == NO_GAME) {
         send_message(player->socket, "You are not currently observing any game\n");
         return;
     }
@@ -1563,229 +4649,222 @@ void handle_quit_observe(Player *player) {
     remove_observer(player);
 }
 
-void handle_observe(Player *player, char *command) {
-    char pseudo[MAX_PSEUDO_LEN];
-    if (sscanf(command, "OBSERVE %10s", pseudo) == 1) { // Limit pseudo to MAX_PSEUDO_LEN
-        // Validate the pseudo
-        if (strlen(pseudo) == 0 || strlen(pseudo) > MAX_PSEUDO_LEN) {
-            send_message(player->socket, "Error reading challenged pseudo\n");
-            memset(pseudo, 0, sizeof(pseudo));
-            return;
-        }
-    }
-    if (strlen(pseudo) == 0) {
-        send_message(player->socket, "Error reading challenged pseudo\n");
-        memset(pseudo, 0, sizeof(pseudo));
+void handle_observe(Player *player, Command *cmd) {
+    Player *to_observe = find_player(cmd->args[0].ptr, cmd->args[0].len);
+
+    if (to_observe == NULL) {
+        send_message(player->socket, "Player not found\n");
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
-    Player *to_observe = find_player_by_pseudo(pseudo);
-    memset(pseudo, 0, sizeof(pseudo));
-
-    if (to_observe->game_id == -1) {
+    if (to_observe->game_count == 0) {
         send_message(player->socket, "Player is not in the game\n");
         return;
     }
 
-    if (!can_observe(player, to_observe->game_id)) {
-        send_message(player->socket, "One or both players is/are in private mode, only friends can observe\n");
-        return;
+    // One game at a time, a game left behind would keep sending its boards
+    if (__atomic_load_n(&player->observing, __ATOMIC_RELAXED) != NO_GAME) {
+        detach_observer(player);
     }
-    pthread_mutex_unlock(&player_mutex);
-
     add_observer(player, to_observe);
 
 }
 
 void send_friend_list(Player *player) {
-    if (player->friend_count == 0) {
-        send_message(player->socket, "You did not add any friends yet...\n");
-        return;
-    }
-
     // Build the list of friends as a message
     char message[1024] = "Your friends are:\n";
 
-    for (int i = 0; i < player->friend_count; i++) {
+    lock_profile(player);
+    int friend_count = player->profile->friend_count;
+    for (int i = 0; i < friend_count; i++) {
         // Append each friend's pseudo to the message
-        strcat(message, player->friends[i]);
+        strcat(message, player->profile->friends[i]);
         strcat(message, "\n");
     }
+    pthread_mutex_unlock(&player->profile->lock);
+
+    if (friend_count == 0) {
+        send_message(player->socket, "You did not add any friends yet...\n");
+        return;
+    }
 
     // Send the list of friends to the player
     send_message(player->socket, message);
-    memset(message, 0, sizeof(message));
 }
 
-void handle_remove_friend(Player *player, char *command) {
-    char pseudo[MAX_PSEUDO_LEN];
-    if (sscanf(command, "REMOVE_FRIEND %10s", pseudo) == 1) { // Limit pseudo to MAX_PSEUDO_LEN
-        // Validate the pseudo
-        if (strlen(pseudo) == 0 || strlen(pseudo) > MAX_PSEUDO_LEN) {
-            send_message(player->socket, "Error reading pseudo\n");
-            memset(pseudo, 0, sizeof(pseudo));
-            return;
-        }
-    }
-
+void handle_remove_friend(Player *player, Command *cmd) {
+    lock_profile(player);
     int friend_index = -1;
-    for (int i = 0; i < player->friend_count; i++) {
-        if (strcmp(player->friends[i], pseudo) == 0) {
+    for (int i = 0; i < player->profile->friend_count; i++) {
+        if (slice_equals(cmd->args[0], player->profile->friends[i])) {
             friend_index = i;
             break;
         }
     }
 
-    memset(pseudo, 0, sizeof(pseudo));  // Clear the temporary variable
     if (friend_index == -1) {
+        pthread_mutex_unlock(&player->profile->lock);
         send_message(player->socket, "The player is not in your friend list\n");
         return;
     }
 
-    for (int i = friend_index; i < player->friend_count - 1; i++) {
-        strcpy(player->friends[i], player->friends[i + 1]);
+    for (int i = friend_index; i < player->profile->friend_count - 1; i++) {
+        strcpy(player->profile->friends[i], player->profile->friends[i + 1]);
     }
-    player->friend_count--;
+    player->profile->friend_count--;
+    player->profile->friends[player->profile->friend_count][0] = '\0';
+    pthread_mutex_unlock(&player->profile->lock);
+
+    journal_player_change("FRIEND_REMOVE %s %.*s", player->pseudo, cmd->args[0].len, cmd->args[0].ptr);
     send_message(player->socket, "Friend removed successfully\n");
 }
 
-void handle_add_friend(Player *player, char *command) {
-    char pseudo[MAX_PSEUDO_LEN];
-    if (sscanf(command, "ADD_FRIEND %10s", pseudo) == 1) { // Limit pseudo to MAX_PSEUDO_LEN
-        // Validate the pseudo
-        if (strlen(pseudo) == 0 || strlen(pseudo) > MAX_PSEUDO_LEN) {
-            send_message(player->socket, "Error reading pseudo\n");
-            memset(pseudo, 0, sizeof(pseudo));
-            return;
-        }
-    }
-    Player *friend_player = find_player_by_pseudo(pseudo);
+void handle_add_friend(Player *player, Command *cmd) {
+    Player *friend_player = find_player(cmd->args[0].ptr, cmd->args[0].len);
 
     if (friend_player == NULL) {
         send_message(player->socket, "Player not found\n");
-        memset(pseudo, 0, sizeof(pseudo));
         return;
     }
 
     if (strcmp(friend_player->pseudo, player->pseudo) == 0) {
         send_message(player->socket, "You can not add yourself as a friend\n");
-        memset(pseudo, 0, sizeof(pseudo));
         return;
     }
 
-    if (friend_player->friend_count >= MAX_FRIENDS) {
+    // Profiles are locked one at a time, never nested
+    lock_profile(friend_player);
+    bool friend_full = friend_player->profile->friend_count >= MAX_FRIENDS;
+    pthread_mutex_unlock(&friend_player->profile->lock);
+    if (friend_full) {
         send_message(player->socket, "Your friend's friend list is full\n");
-        memset(pseudo, 0, sizeof(pseudo));
         return;
     }
 
-    for (int i = 0; i < player->friend_count; i++) {
-        if (strcmp(player->friends[i], pseudo) == 0) {
+    lock_profile(player);
+    for (int i = 0; i < player->profile->friend_count; i++) {
+        if (strcmp(player->profile->friends[i], friend_player->pseudo) == 0) {
+            pthread_mutex_unlock(&player->profile->lock);
             send_message(player->socket, "This player is already your friend\n");
             return;
         }
     }
+    if (player->profile->friend_count >= MAX_FRIENDS) {
+        pthread_mutex_unlock(&player->profile->lock);
+        send_message(player->socket, "Your friend list is full\n");
+        return;
+    }
 
-    strcpy(player->friends[player->friend_count], pseudo);
-    player->friend_count++;
-    printf("%d", player->friend_count);
-    memset(pseudo, 0, sizeof(pseudo));
+    strcpy(player->profile->friends[player->profile->friend_count], friend_player->pseudo);
+    player->profile->friend_count++;
+    printf("%d", player->profile->friend_count);
+    pthread_mutex_unlock(&player->profile->lock);
 
-    update_players_file();
+    journal_player_change("FRIEND_ADD %s %s", player->pseudo, friend_player->pseudo);
 
     send_message(player->socket, "Friend added successfully\n");
 }
 
 void send_pending_challenge(Player *player) {
-    if (player->challenged_by[0] == '\0') {
+    char challenger[MAX_PSEUDO_LEN];
+    pthread_mutex_lock(&challenge_mutex);
+    strcpy(challenger, player->challenged_by);
+    pthread_mutex_unlock(&challenge_mutex);
+
+    if (challenger[0] == '\0') {
         send_message(player->socket, "You do not have a pending challenge!\n");
         return;
     }
 
     char message[MAX_PSEUDO_LEN + 19];
-    snprintf(message, sizeof(message), "Challenge from %s\n", player->challenged_by);
+    snprintf(message, sizeof(message), "Challenge from %s\n", challenger);
     send_message(player->socket, message);
-
-    memset(message, 0, sizeof(message));
 }
 
 void handle_revoke_challenge(Player *player) {
+    pthread_mutex_lock(&challenge_mutex);
     if (player->challenged[0] == '\0') {
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "You did not challenge anyone yet\n");
         return;
     }
 
     Player *challenged = find_player_by_pseudo(player->challenged);
     if (challenged == NULL) {
+        pthread_mutex_unlock(&challenge_mutex);
         send_message(player->socket, "Error finding challenged player\n");
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
     challenged->challenged_by[0] = '\0';
     player->challenged[0] = '\0';
-    pthread_mutex_unlock(&player_mutex);
+    pthread_mutex_unlock(&challenge_mutex);
 
     send_message(player->socket, "You have revoked the challenge\n");
     send_message(challenged->socket, "The challenge was revoked\n");
 }
 
-void handle_challenge(Player *player, char *command) {
-    if (player->observing[0] != '\0') {
+void handle_challenge(Player *player, Command *cmd) {
+    if (__atomic_load_n(&player->observing, __ATOMIC_RELAXED) != NO_GAME) {
         send_message(player->socket, "Stop observing before challenging\n");
         return;
     }
-    if (player->challenged[0] != '\0') {
-        send_message(player->socket, "Wait for a response from previous player challenged\n");
+    if (player->game_count >= MAX_PLAYER_GAMES) {
+        send_message(player->socket, "You are playing too many games already\n");
         return;
     }
 
-    if (player->challenged_by[0] != '\0') {
-        send_message(player->socket, "Accept or decline the pending challenge\n");
+    Slice challenge_user = cmd->args[0];
+    if (!verify_not_self_challenge(player, challenge_user)) {
         return;
     }
-    if (player->game_id != -1) {
-        send_message(player->socket, "You are already in game\n");
+
+    Player *challenged = find_player(challenge_user.ptr, challenge_user.len);
+
+    // Checked before challenge_mutex, which ranks below the games, add_game enforces the cap again
+    Game *existing = acquire_game_against(player, challenge_user);
+    if (existing != NULL) {
+        release_game(existing);
+        send_message(player->socket, "You already have a game with this player.\n");
         return;
     }
 
-    char challenge_user[MAX_PSEUDO_LEN];
-    if (sscanf(command, "CHALLENGE %10s", challenge_user) == 1) { // Limit pseudo to MAX_PSEUDO_LEN
-        // Validate the pseudo
-        if (strlen(challenge_user) == 0 || strlen(challenge_user) > MAX_PSEUDO_LEN) {
-            send_message(player->socket, "Error reading challenged pseudo\n");
-            return;
-        }
+    // Checks and pairing happen under one lock so two challengers cannot both claim the same player
+    pthread_mutex_lock(&challenge_mutex);
+    if (player->challenged[0] != '\0') {
+        pthread_mutex_unlock(&challenge_mutex);
+        send_message(player->socket, "Wait for a response from previous player challenged\n");
+        return;
     }
 
-    if (!verify_not_self_challenge(player, challenge_user)) {
+    if (player->challenged_by[0] != '\0') {
+        pthread_mutex_unlock(&challenge_mutex);
+        send_message(player->socket, "Accept or decline the pending challenge\n");
         return;
     }
 
-    Player *challenged = find_player_by_pseudo(challenge_user);
-
     if (!is_valid_challenge(player, challenged)) {
+        pthread_mutex_unlock(&challenge_mutex);
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
     strcpy(challenged->challenged_by, player->pseudo);
     strcpy(player->challenged, challenged->pseudo);
-    pthread_mutex_unlock(&player_mutex);
+    pthread_mutex_unlock(&challenge_mutex);
 
     send_challenge(player, challenged);
     notify_challenge_sent(player->socket);
 }
 
-bool verify_not_self_challenge(Player *player, char *challenge_user) {
-    if (strcmp(player->pseudo, challenge_user) == 0) {
+bool verify_not_self_challenge(Player *player, Slice challenge_user) {
+    if (slice_equals(challenge_user, player->pseudo)) {
         send_message(player->socket, "You cannot challenge yourself!\n");
         return false;
     }
     return true;
 }
 
+// Caller holds challenge_mutex
 bool is_valid_challenge(Player *player, Player *challenged) {
     if (challenged == NULL) {
         send_message(player->socket, "The player does not exist.\n");
@@ -1795,8 +4874,8 @@ bool is_valid_challenge(Player *player, Player *challenged) {
         send_message(player->socket, "The player is not online.\n");
         return false;
     }
-    if (challenged->game_id != -1) {
-        send_message(player->socket, "The player is already in game.\n");
+    if (challenged->game_count >= MAX_PLAYER_GAMES) {
+        send_message(player->socket, "The player is playing too many games already.\n");
         return false;
     }
     if ((challenged->challenged_by[0] != '\0') || (challenged->challenged[0] != '\0')) {
@@ -1819,130 +4898,403 @@ void send_challenge(Player *player, Player *challenged) {
 }
 
 
-typedef struct {
-    char name[MAX_PSEUDO_LEN];
-    int win_count;
-} PlayerStats;
-
+// Game results normally come with the accounts. Accounts saved before they did are credited from the archive
+// once, and the results are written to a new snapshot straight away so later startups skip the history.
 void load_game_stats() {
-    FILE *file = fopen(GAMES_FILE, "r");
-    if (!file) {
-        file = fopen(GAMES_FILE, "a");
-        if (file) {
-            printf("Game file created.\n");
-            fclose(file);
-        } else {
-            perror("Failed to create game file");
+    open_game_archive();
+    if (results_loaded) {
+        if (access(GAMES_FILE, F_OK) == 0) {
+            printf("%s has not been imported, run socket_server --import-games\n", GAMES_FILE);
         }
         return;
     }
 
-    pthread_mutex_lock(&player_mutex);
-    PlayerStats player_stats[MAX_PLAYERS];  // Array to store player stats
-    int player_count = 0;
+    // Journaled totals of a server that ran without a snapshot are recounted with everything else
+    for (int i = 0; i < registered_players(); i++) {
+        Player *player = player_at(i);
+        player->win_count = 0;
+        player->loss_count = 0;
+        player->draw_count = 0;
+    }
+
+    int counted = 0;
+    if (game_index != NULL) {
+        static GameRecord records[1024];
+        off_t offset = 0;
+        ssize_t got;
+        while ((got = pread(fileno(game_index), records, sizeof(records), offset)) >= (ssize_t) sizeof(GameRecord)) {
+            int count = (int) (got / sizeof(GameRecord));
+            count_archived_games(records, count);
+            counted += count;
+            offset += (off_t) count * sizeof(GameRecord);
+        }
+    }
 
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        // Look for the line containing "Winner: "
-        if (strncmp(line, "Winner:", 7) == 0) {
-            // Extract the winner's name
-            char winner[MAX_PSEUDO_LEN];
-            sscanf(line + 8, "%s", winner);  // Get the player's name after "Winner: "
-
-            // Check if the winner is already in the stats array
-            int found = 0;
-            for (int i = 0; i < player_count; i++) {
-                if (strcmp(player_stats[i].name, winner) == 0) {
-                    player_stats[i].win_count++;  // Increment win count for this player
-                    found = 1;
-                    break;
-                }
+    // Games of an older server count as well, importing them later does not change the results
+    FILE *file = fopen(GAMES_FILE, "r");
+    if (file) {
+        GameRecord record;
+        memset(&record, 0, sizeof(record));
+        char line[256], winner[MAX_PSEUDO_LEN];
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "Player1: %10s", record.player1) == 1 ||
+                sscanf(line, "Player2: %10s", record.player2) == 1) {
+                continue;
             }
-
-            // If the winner isn't in the array, add them
-            if (!found) {
-                strcpy(player_stats[player_count].name, winner);
-                player_stats[player_count].win_count = 1;
-                player_count++;
+            // Look for the line containing "Winner: " and credit both players directly through the index
+            if (sscanf(line, "Winner: %10s", winner) == 1) {
+                record.result = strcmp(winner, record.player1) == 0 ? GAME_RESULT_PLAYER1 :
+                                strcmp(winner, record.player2) == 0 ? GAME_RESULT_PLAYER2 : GAME_RESULT_TIE;
+                count_archived_games(&record, 1);
+                counted++;
             }
         }
+        fclose(file);
+        printf("%s has not been imported, run socket_server --import-games\n", GAMES_FILE);
     }
 
-    // Close the file after processing
-    fclose(file);
+    printf("Counted the results of %d saved games\n", counted);
+    compact_players_file();
+    invalidate_listings(LISTING_BIT(LISTING_TOP) | LISTING_BIT(LISTING_TOP_ONLINE));
+}
+
+// Adds one game to a player's results, outcome is 1 for a win, -1 for a loss and 0 for a draw
+void credit_game_result(Player *player, int outcome) {
+    int *counter = outcome > 0 ? &player->win_count : outcome < 0 ? &player->loss_count : &player->draw_count;
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
 
-    pthread_mutex_unlock(&player_mutex);
+// Counts a saved game in both players' results and journals their new totals
+// Returns the sequence of the last record queued, the caller waits for it once its locks are released
+unsigned long record_game_result(Game *game, GameResult result) {
+    Player *players[2] = {game->player1, game->player2};
+    unsigned long sequence = 0;
+    for (int i = 0; i < 2; i++) {
+        Player *player = players[i];
+        // Queued under the profile lock so a player's totals reach the journal in the order they were reached
+        PlayerProfile *profile = lock_profile(player);
+        GameResult won = i == 0 ? GAME_RESULT_PLAYER1 : GAME_RESULT_PLAYER2;
+        credit_game_result(player, result == GAME_RESULT_TIE ? 0 : result == won ? 1 : -1);
+        sequence = queue_player_change("RESULTS %s %d %d %d", player->pseudo, player->win_count,
+                                       player->loss_count, player->draw_count);
+        pthread_mutex_unlock(&profile->lock);
+    }
+    invalidate_listings(LISTING_BIT(LISTING_TOP) | LISTING_BIT(LISTING_TOP_ONLINE));
+    return sequence;
+}
 
-    for (int i = 0; i < player_count; i++) {
-        find_player_by_pseudo(player_stats[i].name)->win_count = player_stats[i].win_count;
+// Credits the players of archived games, safe to run on several slices at once
+void count_archived_games(const GameRecord *records, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const GameRecord *record = &records[i];
+        Player *player1 = find_player(record->player1, (int) strnlen(record->player1, MAX_PSEUDO_LEN));
+        Player *player2 = find_player(record->player2, (int) strnlen(record->player2, MAX_PSEUDO_LEN));
+        int outcome = record->result == GAME_RESULT_PLAYER1 ? 1 : record->result == GAME_RESULT_PLAYER2 ? -1 : 0;
+        // Accounts deleted since the game leave their side uncounted
+        if (player1 != NULL) {
+            credit_game_result(player1, outcome);
+        }
+        if (player2 != NULL) {
+            credit_game_result(player2, -outcome);
+        }
     }
 }
 
-void save_game(Game *game, char *winner) {
-    pthread_mutex_lock(&player_mutex);
+void *count_archived_games_thread(void *arg) {
+    ArchiveSlice *slice = arg;
+    count_archived_games(slice->records, slice->count);
+    return NULL;
+}
+
+// Recounts every player's results from GAME_INDEX with several threads and writes them to a new snapshot.
+// Runs instead of the server, which must not be serving from the same files meanwhile.
+void rebuild_game_results(int threads) {
+    if (access(GAMES_FILE, F_OK) == 0) {
+        printf("Import %s with --import-games first, its games would not be counted\n", GAMES_FILE);
+        exit(EXIT_FAILURE);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    FILE *file = fopen(GAMES_FILE, "a");
-    if (!file) {
-        printf("Error creating/opening games file\n");
+    load_players_from_file();
+    open_game_archive();
+    if (game_index == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < registered_players(); i++) {
+        Player *player = player_at(i);
+        player->win_count = 0;
+        player->loss_count = 0;
+        player->draw_count = 0;
+    }
+
+    struct stat st;
+    size_t count = fstat(fileno(game_index), &st) == 0 ? (size_t) st.st_size / sizeof(GameRecord) : 0;
+    const GameRecord *records = NULL;
+    if (count > 0) {
+        records = mmap(NULL, count * sizeof(GameRecord), PROT_READ, MAP_PRIVATE, fileno(game_index), 0);
+        if (records == MAP_FAILED) {
+            perror("Failed to map game index");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    pthread_t *thread_ids = calloc(threads, sizeof(pthread_t));
+    ArchiveSlice *slices = calloc(threads, sizeof(ArchiveSlice));
+    if (thread_ids == NULL || slices == NULL) {
+        perror("Failed to allocate rebuild threads");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < threads; i++) {
+        size_t first = count * i / threads;
+        slices[i].records = records + first;
+        slices[i].count = count * (i + 1) / threads - first;
+        if (pthread_create(&thread_ids[i], NULL, count_archived_games_thread, &slices[i]) != 0) {
+            perror("Rebuild thread creation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+    }
+    free(thread_ids);
+    free(slices);
+
+    compact_players_file();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Rebuilt the results of %d players from %zu games with %d threads in %ld ms\n", registered_players(),
+           count, threads, (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000);
+}
+
+// Opens GAME_ARCHIVE and GAME_INDEX for appending and repairs what a crash between their writes left behind
+void open_game_archive() {
+    game_archive = fopen(GAME_ARCHIVE, "a+");
+    game_index = fopen(GAME_INDEX, "a+");
+    struct stat archive_stat, index_stat;
+    if (!game_archive || !game_index || fstat(fileno(game_archive), &archive_stat) != 0 ||
+        fstat(fileno(game_index), &index_stat) != 0) {
+        perror("Failed to open game archive");
+        if (game_archive) {
+            fclose(game_archive);
+        }
+        if (game_index) {
+            fclose(game_index);
+        }
+        game_archive = NULL;
+        game_index = NULL;
         return;
     }
+    game_archive_size = (uint64_t) archive_stat.st_size;
+
+    // Drop a torn index entry and entries for games the archive never fully received
+    GameRecord record;
+    off_t indexed = index_stat.st_size / (off_t) sizeof(GameRecord);
+    uint64_t covered = 0;
+    while (indexed > 0) {
+        if (pread(fileno(game_index), &record, sizeof(record), (indexed - 1) * (off_t) sizeof(record)) ==
+            (ssize_t) sizeof(record) && record.magic == GAME_RECORD_MAGIC &&
+            record.offset + ARCHIVED_GAME_SIZE(&record) <= game_archive_size) {
+            covered = record.offset + ARCHIVED_GAME_SIZE(&record);
+            break;
+        }
+        indexed--;
+    }
+    if (indexed * (off_t) sizeof(GameRecord) != index_stat.st_size &&
+        ftruncate(fileno(game_index), indexed * (off_t) sizeof(GameRecord)) != 0) {
+        perror("Failed to truncate game index");
+    }
 
-    fprintf(file, "Game Start\n");
-    fprintf(file, "Player1: %s\n", game->player1->pseudo);
-    fprintf(file, "Player2: %s\n", game->player2->pseudo);
+    // Games archived after the last index entry are indexed again, a torn last game is cut off
+    int recovered = 0;
+    while (covered + sizeof(record) <= game_archive_size &&
+           pread(fileno(game_archive), &record, sizeof(record), (off_t) covered) == (ssize_t) sizeof(record) &&
+           record.magic == GAME_RECORD_MAGIC && record.offset == covered &&
+           covered + ARCHIVED_GAME_SIZE(&record) <= game_archive_size) {
+        if (fwrite(&record, sizeof(record), 1, game_index) != 1) {
+            perror("Failed to index game");
+            break;
+        }
+        covered += ARCHIVED_GAME_SIZE(&record);
+        recovered++;
+    }
+    if (covered != game_archive_size) {
+        if (ftruncate(fileno(game_archive), (off_t) covered) != 0) {
+            perror("Failed to truncate game archive");
+        }
+        game_archive_size = covered;
+    }
+    if (recovered > 0) {
+        if (fflush(game_index) != 0 || fsync(fileno(game_index)) != 0) {
+            perror("Failed to flush game index");
+        }
+        printf("Indexed %d games missing from %s\n", recovered, GAME_INDEX);
+    }
+}
 
-    fprintf(file, "Moves:\n");
-    Move *move = game->player1->move_history;
-    while (move) {
-        fprintf(file, "%s: Pit: %d, Seeds: %d\n", game->player1->pseudo, move->pit_index, move->seeds_before_move);
-        move = move->next;
+// Appends one saved game to GAME_ARCHIVE and its header to GAME_INDEX, the caller flushes both
+void archive_game(const char *data, int len) {
+    if (game_archive == NULL || game_index == NULL) {
+        return;
     }
+    GameRecord record;
+    memcpy(&record, data, sizeof(record));
+    record.offset = game_archive_size;
+    size_t moves_len = (size_t) len - sizeof(record);
+    if (fwrite(&record, sizeof(record), 1, game_archive) != 1 ||
+        fwrite(data + sizeof(record), 1, moves_len, game_archive) != moves_len ||
+        fwrite(&record, sizeof(record), 1, game_index) != 1) {
+        perror("Failed to archive game");
+    }
+    game_archive_size += (uint64_t) len;
+}
 
-    move = game->player2->move_history;
-    while (move) {
-        fprintf(file, "%s: Pit: %d, Seeds: %d\n", game->player2->pseudo, move->pit_index, move->seeds_before_move);
-        move = move->next;
+// Moves the games of a text GAMES_FILE into the archive, then renames it so they are not counted twice
+void import_games_file() {
+    FILE *file = fopen(GAMES_FILE, "r");
+    if (!file) {
+        perror("Failed to open games file");
+        exit(EXIT_FAILURE);
+    }
+    open_game_archive();
+    if (game_archive == NULL) {
+        exit(EXIT_FAILURE);
     }
 
-    fprintf(file, "Winner: %s\n", winner);
-    fprintf(file, "Game End\n\n");
+    size_t capacity = sizeof(GameRecord) + 2 * 256;
+    char *data = malloc(capacity);
+    if (data == NULL) {
+        perror("Failed to allocate game");
+        exit(EXIT_FAILURE);
+    }
+    GameRecord record;
+    int move_count = 0;
+    bool in_game = false;
+    int imported = 0;
 
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char name[MAX_PSEUDO_LEN];
+        int pit, seeds;
+        if (strncmp(line, "Game Start", 10) == 0) {
+            memset(&record, 0, sizeof(record));
+            record.magic = GAME_RECORD_MAGIC;
+            move_count = 0;
+            in_game = true;
+        } else if (!in_game) {
+            continue;
+        } else if (sscanf(line, "%10[^:]: Pit: %d, Seeds: %d", name, &pit, &seeds) == 3) {
+            if (move_count == UINT16_MAX) {
+                continue;
+            }
+            size_t needed = sizeof(GameRecord) + 2 * (size_t) (move_count + 1);
+            if (needed > capacity) {
+                capacity *= 2;
+                data = realloc(data, capacity);
+                if (data == NULL) {
+                    perror("Failed to allocate game");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            unsigned char *move = (unsigned char *) data + sizeof(GameRecord) + 2 * move_count;
+            move[0] = (unsigned char) (pit | (strcmp(name, record.player1) == 0 ? 0 : MOVE_BY_PLAYER2));
+            move[1] = (unsigned char) seeds;
+            move_count++;
+        } else if (sscanf(line, "Player1: %10s", record.player1) == 1 ||
+                   sscanf(line, "Player2: %10s", record.player2) == 1) {
+            continue;
+        } else if (sscanf(line, "Winner: %10s", name) == 1) {
+            record.result = strcmp(name, record.player1) == 0 ? GAME_RESULT_PLAYER1 :
+                            strcmp(name, record.player2) == 0 ? GAME_RESULT_PLAYER2 : GAME_RESULT_TIE;
+        } else if (strncmp(line, "Game End", 8) == 0) {
+            record.move_count = (uint16_t) move_count;
+            memcpy(data, &record, sizeof(record));
+            archive_game(data, (int) ARCHIVED_GAME_SIZE(&record));
+            imported++;
+            in_game = false;
+        }
+    }
     fclose(file);
-    pthread_mutex_unlock(&player_mutex);
+    free(data);
+
+    if (fflush(game_archive) != 0 || fsync(fileno(game_archive)) != 0 ||
+        fflush(game_index) != 0 || fsync(fileno(game_index)) != 0) {
+        perror("Failed to flush game archive");
+        exit(EXIT_FAILURE);
+    }
+    if (rename(GAMES_FILE, GAMES_FILE ".imported") != 0) {
+        perror("Failed to rename games file");
+        exit(EXIT_FAILURE);
+    }
+    printf("Imported %d games into %s, %s was renamed to %s.imported\n", imported, GAME_ARCHIVE, GAMES_FILE,
+           GAMES_FILE);
+}
+
+// Caller holds game->lock, the record is formatted in memory and written by the persistence thread
+void save_game(Game *game, GameResult result) {
+    int move_count = game->move_count;
+    // Longer games keep their first moves, the record has no room to count more
+    if (move_count > UINT16_MAX) {
+        move_count = UINT16_MAX;
+    }
+
+    int len = (int) sizeof(GameRecord) + 2 * move_count;
+    char *data = calloc(1, len);
+    if (!data) {
+        perror("Failed to allocate game record");
+        return;
+    }
+    GameRecord *record = (GameRecord *) data;
+    record->magic = GAME_RECORD_MAGIC;
+    record->move_count = (uint16_t) move_count;
+    record->result = (uint8_t) result;
+    // The record is zeroed and pseudos are shorter than its fields, so the terminators are already there
+    memcpy(record->player1, game->player1->pseudo, strlen(game->player1->pseudo));
+    memcpy(record->player2, game->player2->pseudo, strlen(game->player2->pseudo));
+    record->started = game->started;
+    record->ended = time(NULL);
+
+    if (move_count > 0) {
+        memcpy(record + 1, game->moves, 2 * (size_t) move_count);
+    }
+
+    queue_record(PERSIST_GAMES, data, len);  // end_game waits behind the results queued after it
+    free(data);
 }
 
 void handle_leave(Player *player) {
-    if (player->game_id == -1) {
+    if (player->game_count == 0) {
         send_message(player->socket, "You are not in the game\n");
         return;
     }
 
-    if (active_games[player->game_id] == NULL) {
+    Game *game = acquire_player_game(player);
+    if (game == NULL) {
         send_message(player->socket, "Game not found\n");
         return;
     }
 
-    if (strcmp(active_games[player->game_id]->player1->pseudo, player->pseudo) == 0) {
-        end_game(player, active_games[player->game_id]->player2, -1, active_games[player->game_id]);
+    if (game->player1 == player) {
+        end_game(player, game->player2, -1, game);
     } else {
-        end_game(player, active_games[player->game_id]->player1, -1, active_games[player->game_id]);
+        end_game(player, game->player1, -1, game);
     }
+    release_game(game);
 }
 
+// Caller holds game->lock, the game leaves the table when the caller releases it
 void end_game(Player *player1, Player *player2, int result, Game *game) {
-    char winner[MAX_PSEUDO_LEN];
     char winner_msg[MAX_PSEUDO_LEN + 8];
     if (result == 0) {
         // Tie condition
-        strcpy(winner, "Tie");
         strcpy(winner_msg, "It's a tie!\n");
     } else if (result == 1) {
         // Player 1 wins
-        strcpy(winner, player1->pseudo);
         sprintf(winner_msg, "%s wins!\n", player1->pseudo);
     } else {
         // Player 2 wins
-        strcpy(winner, player2->pseudo);
         sprintf(winner_msg, "%s wins!\n", player2->pseudo);
     }
 
@@ -1956,124 +5308,218 @@ void end_game(Player *player1, Player *player2, int result, Game *game) {
 
     // Clean up game state
     if (game->save_on_exit) {
-        save_game(game, winner);
-    }
-    memset(winner, 0, sizeof(winner));
-    memset(winner_msg, 0, sizeof(winner_msg));
-    remove_game(player1->game_id);
+        Player *game_winner = result == 1 ? player1 : player2;
+        GameResult archived = result == 0 ? GAME_RESULT_TIE :
+                              game_winner == game->player1 ? GAME_RESULT_PLAYER1 : GAME_RESULT_PLAYER2;
+        save_game(game, archived);
+        // Both records are on disk before anyone hears back, but release_game waits for them unlocked
+        game->persist_sequence = record_game_result(game, archived);
+    }
+    finish_game(game);
 }
 
-int capture_seeds(Player *current_player, Player *opponent, int last_pit) {
-    char message[BUFFER_SIZE];
+// Takes the 2s and 3s on the opposing row, walking back from the pit the last seed landed in, into side's
+// store. Nothing when that pit is on side's own row. Returns the seeds taken.
+int capture_seeds(GameState *state, int side, int last_pit) {
+    const uint8_t *row = &state->pit[(1 - side) * PITS];
+    uint8_t *pit = &state->pit[last_pit];
     int captured_seeds = 0;
 
-    // Notify both players that we are checking for captures
-//    snprintf(message, sizeof(message), "Checking for captures at pit %d...\n", last_pit);
-//    send_message(current_player->socket, message);
-//    send_message(opponent->socket, message);
-
-    while (last_pit >= 0 && (opponent->pits[last_pit] == 2 || opponent->pits[last_pit] == 3)) {
-        // Capture the seeds from the opponent's pit
-        captured_seeds += opponent->pits[last_pit];
-        opponent->pits[last_pit] = 0; // Empty the opponent's pit
-
-        last_pit--; // Move to the next pit on the opponent's side
+    if (pit < row || pit >= row + PITS) {
+        return 0;
     }
-
-    // Add the captured seeds to the current player's store
-    current_player->store += captured_seeds;
-
-    // Notify both players about the capture result
-    if (captured_seeds > 0) {
-        snprintf(message, sizeof(message), "%s captured %d seeds. Their store now has %d seeds.\n",
-                 current_player->pseudo, captured_seeds, current_player->store);
-        send_message(current_player->socket, message);
-        snprintf(message, sizeof(message), "%s captured seeds from your side. Their store now has %d seeds.\n",
-                 current_player->pseudo, current_player->store);
-        send_message(opponent->socket, message);
+    for (; pit >= row && (*pit == 2 || *pit == 3); pit--) {
+        captured_seeds += *pit;
+        *pit = 0;
     }
-
-    memset(message, 0, sizeof(message));
+    state->pit[BOARD_STORE(side)] += captured_seeds;
     return captured_seeds;
 }
 
+// Caller holds game->lock
+void notify_capture(Game *game, int side, int captured_seeds) {
+    char message[BUFFER_SIZE];
+    Player *current_player = side == 0 ? game->player1 : game->player2;
+    Player *opponent = side == 0 ? game->player2 : game->player1;
+    int store = game->state.pit[BOARD_STORE(side)];
+
+    snprintf(message, sizeof(message), "%s captured %d seeds. Their store now has %d seeds.\n",
+             current_player->pseudo, captured_seeds, store);
+    send_message(current_player->socket, message);
+    snprintf(message, sizeof(message), "%s captured seeds from your side. Their store now has %d seeds.\n",
+             current_player->pseudo, store);
+    send_message(opponent->socket, message);
+}
+
 void handle_save_game(Player *player) {
-    if (player->game_id == -1) {
+    if (player->game_count == 0) {
         send_message(player->socket, "You are not in the game\n");
         return;
     }
 
-    Game *game = active_games[player->game_id];
+    Game *game = acquire_player_game(player);
     if (game == NULL) {
         send_message(player->socket, "Game not found\n");
         return;
     }
 
     game->save_on_exit = true;
+    release_game(game);
     send_message(player->socket, "The game will be saved after its end\n");
 }
 
 
-void make_move(Player *player, char *command) {
-    Game *game = active_games[player->game_id];
-    if (game == NULL) {
-        send_message(player->socket, "You are not currently in a game!\n");
+void send_my_games(Player *player) {
+    GameHandle handles[MAX_PLAYER_GAMES];
+    int count = player_games(player, handles);
+    if (count == 0) {
+        send_message(player->socket, "You are not in any game\n");
         return;
     }
 
-    if (strcmp(player->pseudo, game->current_turn) != 0) {
-        send_message(player->socket, "Wait for your turn!\n");
+    char message[BUFFER_SIZE] = "Your games:\n";
+    size_t len = strlen(message);
+    GameHandle current = __atomic_load_n(&player->current_game, __ATOMIC_RELAXED);
+    for (int i = 0; i < count; i++) {
+        Game *game = acquire_game(handles[i]);
+        if (game == NULL) {
+            continue;  // Ended since the handles were copied
+        }
+        Player *opponent = game->player1 == player ? game->player2 : game->player1;
+        char line[MAX_PSEUDO_LEN + 32];
+        int written = snprintf(line, sizeof(line), "%s - %s%s\n", opponent->pseudo,
+                               strcmp(game->current_turn, player->pseudo) == 0 ? "your turn" : "their turn",
+                               handles[i] == current ? " (current)" : "");
+        release_game(game);
+        // A full list of games outgrows one buffer
+        if (len + written >= sizeof(message)) {
+            send_message(player->socket, message);
+            len = 0;
+        }
+        memcpy(message + len, line, written + 1);
+        len += written;
+    }
+    send_message(player->socket, message);
+}
+
+// Makes the game against the named opponent the one moves and messages go to. False if there is none.
+bool switch_game(Player *player, Slice opponent) {
+    // Only the player's own thread writes its current game, so readers of the table suffice
+    pthread_rwlock_rdlock(&games_lock);
+    GameHandle handle = find_game_against(player, opponent);
+    if (handle != NO_GAME) {
+        __atomic_store_n(&player->current_game, handle, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&games_lock);
+    return handle != NO_GAME;
+}
+
+void handle_switch_game(Player *player, Command *cmd) {
+    if (!switch_game(player, cmd->args[0])) {
+        send_message(player->socket, "You have no game with this player\n");
+        return;
+    }
+
+    Game *game = acquire_player_game(player);
+    if (game == NULL) {
+        send_message(player->socket, "Game not found\n");
         return;
     }
+    Player *opponent = game->player1 == player ? game->player2 : game->player1;
+    char message[MAX_PSEUDO_LEN + 32];
+    snprintf(message, sizeof(message), "Now playing against %s\n", opponent->pseudo);
+    send_message(player->socket, message);
+    send_board(player->socket, game, game->player1 == player ? 0 : 1);
+    release_game(game);
+}
 
+void make_move(Player *player, Command *cmd) {
     int pit_index = -1;
 
-    if (sscanf(command, "MAKE_MOVE %2d", &pit_index) == 1) { // Limit to 2 digits
+    if (!slice_to_int(cmd->args[0], &pit_index)) {
+        send_error(player->socket, "Invalid command format. Use: MAKE_MOVE <pit_number> [opponent]");
+        return;
+    }
+    // Naming the opponent plays in that game, which becomes the current one
+    if (cmd->argc >= 2 && !switch_game(player, cmd->args[1])) {
+        send_error(player->socket, "You have no game with this player.");
+        return;
+    }
+    play_move(player, pit_index);
+}
 
-        if (pit_index < 1 || pit_index > PITS) {
-            send_message(player->socket, "Invalid pit selection. Please choose a valid pit.\n");
-            return;
-        }
+// Pit is 1-based as typed by the player, shared by MAKE_MOVE and binary MSG_MOVE frames
+void play_move(Player *player, int pit_index) {
+    // Only this game's lock is taken, moves in other games proceed in parallel
+    Game *game = acquire_player_game(player);
+    if (game == NULL) {
+        send_error(player->socket, "You are not currently in a game!");
+        return;
+    }
 
-        if (player->pits[pit_index - 1] == 0) { // Adjust for 0-based indexing
-            send_message(player->socket, "Pit has no seeds. Please choose again.\n");
-            return;
-        }
-        pit_index--; // Convert to 0-based indexing
+    if (strcmp(player->pseudo, game->current_turn) != 0) {
+        release_game(game);
+        send_error(player->socket, "Wait for your turn!");
+        return;
+    }
 
-        add_move(player, pit_index, player->pits[pit_index]);
+    if (pit_index < 1 || pit_index > PITS) {
+        release_game(game);
+        send_error(player->socket, "Invalid pit selection. Please choose a valid pit.");
+        return;
+    }
 
-        Player *opponent;
-        if (strcmp(player->pseudo, game->player1->pseudo) == 0) {
-            opponent = game->player2;
-        } else {
-            opponent = game->player1;
-        }
+    int side = player == game->player1 ? 0 : 1;
+    const uint8_t *pits = &game->state.pit[side * PITS];
+    if (pits[pit_index - 1] == 0) { // Adjust for 0-based indexing
+        release_game(game);
+        send_error(player->socket, "Pit has no seeds. Please choose again.");
+        return;
+    }
+    pit_index--; // Convert to 0-based indexing
 
-        if (opponent == NULL) {
-            fprintf(stderr, "ERROR: Opponent is NULL\n");
-            return;
-        }
+    add_move(game, player, pit_index, pits[pit_index]);
 
-        notify_move(player->pseudo, pit_index, game);
-        distribute_seeds(player, opponent, pit_index);
+    Player *opponent;
+    if (strcmp(player->pseudo, game->player1->pseudo) == 0) {
+        opponent = game->player2;
+    } else {
+        opponent = game->player1;
+    }
 
-        send_boards(game);
+    if (opponent == NULL) {
+        fprintf(stderr, "ERROR: Opponent is NULL\n");
+        release_game(game);
+        return;
+    }
 
-        if (is_game_over(*player, *opponent)) {
-            int result = player->store > opponent->store ? 1 : (player->store < opponent->store ? -1 : 0);
-            end_game(player, opponent, result, game);
-            return;
-        }
+    notify_move(player->pseudo, pit_index, game);
+    int captured_seeds = capture_seeds(&game->state, side, distribute_seeds(&game->state, side, pit_index));
+    if (captured_seeds > 0) {
+        notify_capture(game, side, captured_seeds);
+    }
 
-        send_message(player->socket, "Your turn is over.\n");
-        send_message(opponent->socket, "Your turn!\n");
-        strcpy(game->current_turn, opponent->pseudo);
+    send_boards(game);
 
+    if (is_game_over(&game->state)) {
+        int store = game->state.pit[BOARD_STORE(side)];
+        int opponent_store = game->state.pit[BOARD_STORE(1 - side)];
+        int result = store > opponent_store ? 1 : (store < opponent_store ? -1 : 0);
+        end_game(player, opponent, result, game);
+        release_game(game);
+        return;
+    }
 
+    send_message(player->socket, "Your turn is over.\n");
+    if (opponent->game_count > 1) {
+        char turn_msg[MAX_PSEUDO_LEN + 32];
+        snprintf(turn_msg, sizeof(turn_msg), "Your turn against %s!\n", player->pseudo);
+        send_message(opponent->socket, turn_msg);
     } else {
-        send_message(player->socket, "Invalid command format. Use: MAKE_MOVE <pit_number>\n");
+        send_message(opponent->socket, "Your turn!\n");
     }
+    strcpy(game->current_turn, opponent->pseudo);
+    release_game(game);
 }
 
 
@@ -2095,85 +5541,92 @@ void make_move(Player *player, char *command) {
 //    memset(*response, 0, sizeof(response));
 //}
 
-void add_move(Player *player, int pit_index, int seeds_before_move) {
-    Move *new_move = (Move *) malloc(sizeof(Move));
-    if (!new_move) {
-        perror("Failed to allocate memory for move");
-        exit(1);
+// Appends to the game's move log, caller holds game->lock
+void add_move(Game *game, Player *player, int pit_index, int seeds_before_move) {
+    if (game->move_count == game->move_capacity) {
+        unsigned char *moves;
+        int capacity = game->move_capacity > 0 ? 2 * game->move_capacity : MOVE_LOG_INITIAL;
+        if (capacity == MOVE_LOG_INITIAL) {
+            moves = pool_alloc(&move_log_pool);
+        } else if (game->move_capacity == MOVE_LOG_INITIAL) {
+            // Outgrew its pooled block, rare enough for the system allocator
+            moves = malloc(2 * (size_t) capacity);
+            if (moves) {
+                memcpy(moves, game->moves, 2 * (size_t) game->move_count);
+                pool_free(&move_log_pool, game->moves);
+            }
+        } else {
+            moves = realloc(game->moves, 2 * (size_t) capacity);
+        }
+        if (!moves) {
+            perror("Failed to allocate memory for move");
+            exit(1);
+        }
+        game->moves = moves;
+        game->move_capacity = capacity;
     }
 
-    new_move->pit_index = pit_index;
-    new_move->seeds_before_move = seeds_before_move;
-    new_move->next = NULL;
+    unsigned char *move = game->moves + 2 * game->move_count++;
+    move[0] = (unsigned char) (pit_index | (player == game->player2 ? MOVE_BY_PLAYER2 : 0));
+    move[1] = (unsigned char) seeds_before_move;
+}
 
-    if (!player->move_history) {
-        player->move_history = new_move;
-    } else {
-        Move *current = player->move_history;
-        while (current->next) {
-            current = current->next;
+void init_sowing_tables() {
+    for (int origin = 0; origin < BOARD_PITS; origin++) {
+        BoardVector rest = {0};
+        for (int n = 0; n < SOW_CYCLE; n++) {
+            sow_rest[origin][n] = rest;
+            // With no seeds past full laps, the last one ended the lap in the pit before the origin
+            sow_last[origin][n] = (origin + (n > 0 ? n : SOW_CYCLE)) % BOARD_PITS;
+            rest[(origin + n + 1) % BOARD_PITS] = 1;
         }
-        current->next = new_move;
+        sow_lap[origin] = rest;
     }
 }
 
-int distribute_seeds(Player *current_player, Player *opponent, int pit_index) {
-    int curr_pit = pit_index;
-    int seeds = current_player->pits[pit_index];
-    current_player->pits[pit_index] = 0;
-
-    while (1) {
-        for (; curr_pit < PITS && seeds > 0; curr_pit++) {
-            if (pit_index == curr_pit) continue;
-            seeds--;
-            current_player->pits[curr_pit]++;
-        }
-        if (seeds == 0) break;
-        curr_pit = 0;
-        for (; curr_pit < PITS && seeds > 0; curr_pit++) {
-            seeds--;
-            opponent->pits[curr_pit]++;
-            if (seeds == 0) {
-                capture_seeds(current_player, opponent, curr_pit);
-            }
-
-        }
-        curr_pit = 0;
-        if (seeds == 0) break;
-    }
+// Empties side's pit and sows its seeds counterclockwise over both rows, never back into it. Full laps are
+// added to the whole board at once, the remainder from the table. Returns the board pit of the last seed.
+int distribute_seeds(GameState *state, int side, int pit_index) {
+    int origin = side * PITS + pit_index;
+    int seeds = state->pit[origin];
+    int rest = seeds % SOW_CYCLE;
 
-    return curr_pit; // Return the last pit index
+    state->pit[origin] = 0;
+    state->cells += sow_lap[origin] * (uint8_t) (seeds / SOW_CYCLE) + sow_rest[origin][rest];
+    return sow_last[origin][rest];
 }
 
-int is_game_over(Player player1, Player player2) {
-    if (player1.store >= 25 || player2.store >= 25) {
+int is_game_over(const GameState *state) {
+    if (state->pit[BOARD_STORE(0)] >= 25 || state->pit[BOARD_STORE(1)] >= 25) {
         return 1; // Game is over
     }
 
-    if (dead(player1) && !is_savior(player2)) {
+    const uint8_t *row1 = &state->pit[0];
+    const uint8_t *row2 = &state->pit[PITS];
+    if (dead(row1) && !is_savior(row2)) {
         return 1; // Player 1 has no seeds and Player 2 is not a savior
-    } else if (dead(player2) && !is_savior(player1)) {
+    } else if (dead(row2) && !is_savior(row1)) {
         return 1; // Player 2 has no seeds and Player 1 is not a savior
     }
 
     return 0; // Game continues
 }
 
-// Function to check if a player is dead (no seeds left in pits)
-int dead(Player player) {
+// Function to check if a row is dead (no seeds left in pits)
+int dead(const uint8_t *pits) {
     for (int i = 0; i < PITS; i++) {
-        if (player.pits[i] > 0) {
+        if (pits[i] > 0) {
             return 0; // Player is not dead
         }
     }
     return 1; // Player is dead
 }
 
-// Function to check if a player can act as a savior (repopulate seeds)
-int is_savior(Player player) {
+// Function to check if a row can act as a savior (repopulate seeds)
+int is_savior(const uint8_t *pits) {
     int total_seeds = 0;
     for (int i = 0; i < PITS; i++) {
-        total_seeds += player.pits[i];
+        total_seeds += pits[i];
     }
     return total_seeds > 1; // Can act as savior if more than 1 seed
 }